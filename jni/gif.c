@@ -15,6 +15,45 @@ static __time_t getRealTime(void);
  */
 static void cleanUp(GifInfo* info);
 
+/**
+ * Frees all seek checkpoints, disabling them.
+ */
+static void freeCheckpoints(GifInfo* info);
+
+/**
+ * Frees replay cache, disabling it.
+ */
+static void freeReplayCache(GifInfo* info);
+
+/**
+ * @return color map used by given frame
+ */
+static const ColorMapObject* getFrameColorMap(const SavedImage* frame,
+		const ColorMapObject* cmap);
+
+/**
+ * Selects pixel kernels supported by the CPU
+ */
+static void initKernels(void);
+
+#if MAX_DECODE_THREADS > 0
+/**
+ * Draws current frame from raster decoded in background.
+ * @return false if frame was not decoded ahead, it has to be decoded then
+ */
+static bool drawDecodedAhead(GifInfo* info, argb* bm);
+
+/**
+ * Asks shared scheduler to decode frame following current one before it is due.
+ */
+static void requestDecodeAhead(GifInfo* info);
+
+/**
+ * Withdraws instance from shared scheduler, disabling decoding ahead.
+ */
+static void stopDecodeAhead(GifInfo* info);
+#endif
+
 static JavaVM* g_jvm;
 static ColorMapObject* defaultCmap = NULL;
 
@@ -36,10 +75,23 @@ static ColorMapObject* genDefColorMap(void)
 
 static void cleanUp(GifInfo* info)
 {
+#if MAX_DECODE_THREADS > 0
+	stopDecodeAhead(info);
+#endif
 	free(info->backupPtr);
 	info->backupPtr = NULL;
 	free(info->infos);
 	info->infos = NULL;
+	free(info->frameStartTimes);
+	info->frameStartTimes = NULL;
+	freeCheckpoints(info);
+	freeReplayCache(info);
+	int i;
+	for (i = 0; i < info->colorTableCount; i++)
+		free(info->colorTables[i]);
+	free(info->colorTables);
+	info->colorTables = NULL;
+	info->colorTableCount = 0;
 	free(info->rasterBits);
 	info->rasterBits = NULL;
 	free(info->comment);
@@ -75,80 +127,346 @@ static __time_t getRealTime(void)
 	return -1;
 }
 
-static int fileRead(GifFileType *gif, GifByteType *bytes, int size)
+static long long getMicroTime(void)
 {
-	FILE* file = (FILE*) gif->UserData;
-	return (int) fread(bytes, 1, (size_t) size, file);
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != -1)
+		return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+	return 0;
 }
 
-static JNIEnv *getEnv(void)
+#ifdef GIF_TRACE
+static bool tracingEnabled;
+static TraceBuffer* traceBuffers; //never freed, so they can be written while threads exit
+static pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t traceKey;
+static pthread_once_t traceKeyOnce = PTHREAD_ONCE_INIT;
+static __thread TraceBuffer* threadTraceBuffer;
+static __thread long threadId;
+
+static void releaseTraceBuffer(void* buffer)
 {
-	JNIEnv* env = NULL;
-    (*g_jvm)->AttachCurrentThread(g_jvm, &env, NULL);
-	return env;
+	pthread_mutex_lock(&traceMutex);
+	((TraceBuffer*) buffer)->owned = false;
+	pthread_mutex_unlock(&traceMutex);
 }
 
-static int directByteBufferReadFun(GifFileType* gif, GifByteType* bytes, int size)
+static void createTraceKey(void)
 {
-	DirectByteBufferContainer* dbbc = gif->UserData;
-	if (dbbc->pos + size > dbbc->capacity)
-		size -= dbbc->pos + size - dbbc->capacity;
-	memcpy(bytes, dbbc->bytes + dbbc->pos, (size_t) size);
-	dbbc->pos += size;
-	return size;
+	pthread_key_create(&traceKey, releaseTraceBuffer);
 }
 
-static int byteArrayReadFun(GifFileType* gif, GifByteType* bytes, int size)
+/**
+ * Claims buffer released by exited thread or allocates new one.
+ * @return NULL if memory is exhausted
+ */
+static TraceBuffer* claimTraceBuffer(void)
 {
-	ByteArrayContainer* bac = gif->UserData;
-	JNIEnv* env = NULL;
-	(*g_jvm)->AttachCurrentThread(g_jvm, &env, NULL);
-	if (bac->pos + size > bac->arrLen)
-		size -= bac->pos + size - bac->arrLen;
-	(*env)->GetByteArrayRegion(env, bac->buffer, (jsize) bac->pos, size, (jbyte *) bytes);
-	bac->pos += size;
-	return size;
+	pthread_once(&traceKeyOnce, createTraceKey);
+	pthread_mutex_lock(&traceMutex);
+	TraceBuffer* buffer = traceBuffers;
+	while (buffer != NULL && buffer->owned)
+		buffer = buffer->next;
+	if (buffer == NULL)
+	{
+		buffer = calloc(1, sizeof(TraceBuffer));
+		if (buffer != NULL)
+		{
+			buffer->next = traceBuffers;
+			traceBuffers = buffer;
+		}
+	}
+	if (buffer != NULL)
+		buffer->owned = true;
+	pthread_mutex_unlock(&traceMutex);
+	if (buffer != NULL)
+		pthread_setspecific(traceKey, buffer);
+	return buffer;
 }
 
-static int streamReadFun(GifFileType* gif, GifByteType* bytes, int size)
+static void recordTraceEvent(const void* gif, const char* name, int phase)
 {
-	StreamContainer* sc = gif->UserData;
-	JNIEnv* env = getEnv();
+	TraceBuffer* buffer = threadTraceBuffer;
+	if (buffer == NULL)
+	{
+		buffer = threadTraceBuffer = claimTraceBuffer();
+		if (buffer == NULL)
+			return;
+		threadId = syscall(__NR_gettid);
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	const uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_RELAXED);
+	TraceEvent* event = &buffer->events[head & (TRACE_BUFFER_EVENTS - 1)];
+	//reader skips event while it is overwritten, fields are published by seq
+	__atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&event->time, ts.tv_sec * 1000000000LL + ts.tv_nsec,
+			__ATOMIC_RELAXED);
+	__atomic_store_n(&event->name, name, __ATOMIC_RELAXED);
+	__atomic_store_n(&event->gif, gif, __ATOMIC_RELAXED);
+	__atomic_store_n(&event->tid, threadId, __ATOMIC_RELAXED);
+	__atomic_store_n(&event->phase, phase, __ATOMIC_RELAXED);
+	__atomic_store_n(&event->seq, head + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&buffer->head, head + 1, __ATOMIC_RELEASE);
+}
 
-	(*env)->MonitorEnter(env, sc->stream);
+static inline void traceEvent(const void* gif, const char* name, int phase)
+{
+	if (__atomic_load_n(&tracingEnabled, __ATOMIC_RELAXED))
+		recordTraceEvent(gif, name, phase);
+}
 
-	if (sc->buffer == NULL)
+static inline TraceScope beginTraceScope(const void* gif, const char* name)
+{
+	TraceScope scope = { gif, NULL };
+	if (__atomic_load_n(&tracingEnabled, __ATOMIC_RELAXED))
 	{
-		jbyteArray buffer = (*env)->NewByteArray(env, size < 256 ? 256 : size);
-		sc->buffer = (*env)->NewGlobalRef(env, buffer);
+		recordTraceEvent(gif, name, 'B');
+		scope.name = name;
 	}
-	else
+	return scope;
+}
+
+static void endTraceScope(TraceScope* scope)
+{
+	if (scope->name != NULL)
+		recordTraceEvent(scope->gif, scope->name, 'E');
+}
+
+static const char* getRecordName(GifRecordType RecordType)
+{
+	switch (RecordType)
 	{
-		jsize bufLen = (*env)->GetArrayLength(env, sc->buffer);
-		if (bufLen < size)
-		{
-			(*env)->DeleteGlobalRef(env, sc->buffer);
-			sc->buffer = NULL;
+	case IMAGE_DESC_RECORD_TYPE:
+		return "image record";
+	case EXTENSION_RECORD_TYPE:
+		return "extension record";
+	default:
+		return "terminator";
+	}
+}
 
-			jbyteArray buffer = (*env)->NewByteArray(env, size);
-			sc->buffer = (*env)->NewGlobalRef(env, buffer);
+/**
+ * Writes events of given buffer which have not been written yet and
+ * are still there.
+ * @return false if file cannot be written
+ */
+static bool writeTraceBuffer(FILE* file, TraceBuffer* buffer, int pid)
+{
+	const uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+	uint64_t i = buffer->flushed;
+	if (head - i > TRACE_BUFFER_EVENTS)
+		i = head - TRACE_BUFFER_EVENTS;
+	buffer->flushed = head;
+	for (; i < head; i++)
+	{
+		TraceEvent* event = &buffer->events[i & (TRACE_BUFFER_EVENTS - 1)];
+		const uint64_t seq = __atomic_load_n(&event->seq, __ATOMIC_ACQUIRE);
+		const long long time = __atomic_load_n(&event->time, __ATOMIC_RELAXED);
+		const char* name = __atomic_load_n(&event->name, __ATOMIC_RELAXED);
+		const void* gif = __atomic_load_n(&event->gif, __ATOMIC_RELAXED);
+		const long tid = __atomic_load_n(&event->tid, __ATOMIC_RELAXED);
+		const int phase = __atomic_load_n(&event->phase, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		//event has been overwritten by owner thread meanwhile
+		if (seq != i + 1 || __atomic_load_n(&event->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+		int written;
+		if (gif != NULL)
+			written = fprintf(file, "{\"name\":\"%s\",\"cat\":\"gif\",\"ph\":\"%c\","
+					"\"ts\":%lld.%03lld,\"pid\":%d,\"tid\":%ld,\"args\":{\"gif\":\"%p\"}},\n",
+					name, phase, time / 1000, time % 1000, pid, tid, gif);
+		else
+			written = fprintf(file, "{\"name\":\"%s\",\"cat\":\"gif\",\"ph\":\"%c\","
+					"\"ts\":%lld.%03lld,\"pid\":%d,\"tid\":%ld},\n",
+					name, phase, time / 1000, time % 1000, pid, tid);
+		if (written < 0)
+			return false;
+	}
+	return true;
+}
+
+static void addStageTime(StageTime* stages, int* stageCount, int maxStages,
+		const char* name, long long nanos)
+{
+	int i;
+	for (i = 0; i < *stageCount; i++)
+		if (strcmp(stages[i].name, name) == 0)
+			break;
+	if (i == *stageCount)
+	{
+		if (i >= maxStages)
+			return;
+		stages[i].name = name;
+		stages[i].nanos = 0;
+		stages[i].count = 0;
+		(*stageCount)++;
+	}
+	stages[i].nanos += nanos;
+	stages[i].count++;
+}
+
+/**
+ * Matches begin and end events of buffer recorded since the previous call,
+ * stages still open are carried over to the next one.
+ */
+static void sumTraceBuffer(TraceBuffer* buffer, StageTime* stages,
+		int* stageCount, int maxStages)
+{
+	const uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+	uint64_t i = buffer->summed;
+	if (head - i > TRACE_BUFFER_EVENTS)
+	{
+		i = head - TRACE_BUFFER_EVENTS;
+		buffer->openStages = 0;
+	}
+	buffer->summed = head;
+	for (; i < head; i++)
+	{
+		TraceEvent* event = &buffer->events[i & (TRACE_BUFFER_EVENTS - 1)];
+		const uint64_t seq = __atomic_load_n(&event->seq, __ATOMIC_ACQUIRE);
+		TraceEvent copy;
+		copy.time = __atomic_load_n(&event->time, __ATOMIC_RELAXED);
+		copy.name = __atomic_load_n(&event->name, __ATOMIC_RELAXED);
+		copy.phase = __atomic_load_n(&event->phase, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		//event has been overwritten by owner thread meanwhile, pairs are lost
+		if (seq != i + 1 || __atomic_load_n(&event->seq, __ATOMIC_RELAXED) != seq)
+		{
+			buffer->openStages = 0;
+			continue;
 		}
+		if (copy.phase == 'B')
+		{
+			if (buffer->openStages < TRACE_STAGE_DEPTH)
+				buffer->stageBegins[buffer->openStages] = copy;
+			buffer->openStages++;
+		}
+		else if (buffer->openStages > 0)
+		{
+			const int depth = --buffer->openStages;
+			if (depth < TRACE_STAGE_DEPTH
+					&& strcmp(buffer->stageBegins[depth].name, copy.name) == 0)
+				addStageTime(stages, stageCount, maxStages, copy.name,
+						copy.time - buffer->stageBegins[depth].time);
+		}
+	}
+}
+#endif
+
+static int rewindInput(GifInfo* info)
+{
+	info->stats.rewinds++;
+	TRACE_BEGIN(info, "rewind");
+	const int result = info->rewindFunction(info);
+	TRACE_END(info, "rewind");
+	return result;
+}
+
+static int fileRead(GifFileType *gif, GifByteType *bytes, int size)
+{
+	FILE* file = (FILE*) gif->UserData;
+	return (int) fread(bytes, 1, (size_t) size, file);
+}
+
+static JNIEnv *getEnv(void)
+{
+	JNIEnv* env = NULL;
+    (*g_jvm)->AttachCurrentThread(g_jvm, &env, NULL);
+	return env;
+}
+
+/**
+ * Reads next chunk of the stream, dropping already parsed bytes unless
+ * they are spooled. Returns false if nothing more can be read.
+ */
+static bool readStreamChunk(StreamContainer* sc)
+{
+	if (sc->eof)
+		return false;
+	if (sc->spooled && sc->dataLength + STREAM_CHUNK_SIZE > STREAM_SPOOL_MAX_BYTES)
+		sc->spooled = false;
+	if (!sc->spooled && sc->dataPos > 0)
+	{
+		memmove(sc->data, sc->data + sc->dataPos, sc->dataLength - sc->dataPos);
+		sc->dataStart += sc->dataPos;
+		sc->dataLength -= sc->dataPos;
+		sc->dataPos = 0;
+	}
+	if (sc->dataLength + STREAM_CHUNK_SIZE > sc->dataCapacity)
+	{
+		size_t capacity = sc->dataCapacity * 2;
+		if (capacity < sc->dataLength + STREAM_CHUNK_SIZE)
+			capacity = sc->dataLength + STREAM_CHUNK_SIZE;
+		GifByteType* data = realloc(sc->data, capacity);
+		if (data == NULL)
+			return false;
+		sc->data = data;
+		sc->dataCapacity = capacity;
 	}
 
-	int len = (*env)->CallIntMethod(env, sc->stream, sc->readMID, sc->buffer, 0, size);
+	JNIEnv* env = getEnv();
+	(*env)->MonitorEnter(env, sc->stream);
+	if (sc->buffer == NULL)
+	{
+		jbyteArray buffer = (*env)->NewByteArray(env, STREAM_CHUNK_SIZE);
+		if (buffer != NULL)
+			sc->buffer = (*env)->NewGlobalRef(env, buffer);
+	}
+	int len = -1;
+	if (sc->buffer != NULL)
+		len = (*env)->CallIntMethod(env, sc->stream, sc->readMID, sc->buffer, 0,
+				STREAM_CHUNK_SIZE);
 	if ((*env)->ExceptionOccurred(env))
 	{
 		(*env)->ExceptionClear(env);
-		len = 0;
+		len = -1;
 	}
 	else if (len > 0)
 	{
-		(*env)->GetByteArrayRegion(env, sc->buffer, 0, len, (jbyte *) bytes);
+		(*env)->GetByteArrayRegion(env, sc->buffer, 0, len,
+				(jbyte *) sc->data + sc->dataLength);
+		sc->dataLength += len;
 	}
-
 	(*env)->MonitorExit(env, sc->stream);
 
-	return len >= 0 ? len : 0;
+	//read(byte[]...) may return 0 only if no bytes were requested
+	if (len <= 0)
+		sc->eof = true;
+	return len > 0;
+}
+
+/**
+ * Reads from chunk buffer, refilling it as needed. Bytes are skipped if
+ * destination is NULL.
+ */
+static int streamReadFun(GifFileType* gif, GifByteType* bytes, int size)
+{
+	StreamContainer* sc = gif->UserData;
+	int copied = 0;
+	while (copied < size)
+	{
+		size_t available = sc->dataLength - sc->dataPos;
+		if (available == 0)
+		{
+			if (!readStreamChunk(sc))
+				break;
+			continue;
+		}
+		if (available > (size_t) (size - copied))
+			available = (size_t) (size - copied);
+		if (bytes != NULL)
+			memcpy(bytes + copied, sc->data + sc->dataPos, available);
+		sc->dataPos += available;
+		copied += available;
+	}
+	return copied;
+}
+
+static int streamSkipFun(GifFileType* gif, int size)
+{
+	return streamReadFun(gif, NULL, size);
 }
 
 static int fileRewind(GifInfo *info)
@@ -156,34 +474,81 @@ static int fileRewind(GifInfo *info)
 	return fseek(info->gifFilePtr->UserData, info->startPos, SEEK_SET);
 }
 
-static int streamRewind(GifInfo *info)
+/**
+ * Moves to given position, within read bytes if possible. Otherwise stream is
+ * reset to its beginning, marked before opening, and read up to position.
+ */
+static int streamSeek(GifInfo *info, long pos)
 {
-	GifFileType* gif = info->gifFilePtr;
-	StreamContainer* sc = gif->UserData;
-	JNIEnv* env = getEnv();
-	(*env)->CallVoidMethod(env, sc->stream, sc->resetMID);
-	if ((*env)->ExceptionOccurred(env))
+	StreamContainer* sc = info->gifFilePtr->UserData;
+	if (pos < sc->dataStart)
 	{
-		(*env)->ExceptionClear(env);
-		return -1;
+		JNIEnv* env = getEnv();
+		(*env)->CallVoidMethod(env, sc->stream, sc->resetMID);
+		if ((*env)->ExceptionOccurred(env))
+		{
+			(*env)->ExceptionClear(env);
+			return -1;
+		}
+		sc->dataStart = 0;
+		sc->dataLength = 0;
+		sc->dataPos = 0;
+		sc->eof = false;
 	}
+	while (pos > sc->dataStart + (long) sc->dataLength)
+	{
+		sc->dataPos = sc->dataLength;
+		if (!readStreamChunk(sc))
+			return -1;
+	}
+	sc->dataPos = (size_t) (pos - sc->dataStart);
 	return 0;
 }
 
+static long streamTell(GifInfo *info)
+{
+	StreamContainer* sc = info->gifFilePtr->UserData;
+	return sc->dataStart + (long) sc->dataPos;
+}
+
+static int streamRewind(GifInfo *info)
+{
+	return streamSeek(info, info->startPos);
+}
+
 static int byteArrayRewind(GifInfo *info)
 {
-	GifFileType* gif = info->gifFilePtr;
-	ByteArrayContainer* bac = gif->UserData;
-	bac->pos = info->startPos;
-	return 0;
+	return DGifSeekMem(info->gifFilePtr, info->startPos) == GIF_OK ? 0 : -1;
 }
 
 static int directByteBufferRewindFun(GifInfo* info)
 {
-	GifFileType* gif = info->gifFilePtr;
-	DirectByteBufferContainer* dbbc = gif->UserData;
-	dbbc->pos = info->startPos;
-	return 0;
+	return DGifSeekMem(info->gifFilePtr, info->startPos) == GIF_OK ? 0 : -1;
+}
+
+static int mappedFileRewind(GifInfo* info)
+{
+	return DGifSeekMem(info->gifFilePtr, info->startPos) == GIF_OK ? 0 : -1;
+}
+
+static int fileSeek(GifInfo *info, long pos)
+{
+	return fseek(info->gifFilePtr->UserData, pos, SEEK_SET);
+}
+
+static long fileTell(GifInfo *info)
+{
+	return ftell(info->gifFilePtr->UserData);
+}
+
+static int memSeek(GifInfo *info, long pos)
+{
+	return DGifSeekMem(info->gifFilePtr, pos) == GIF_OK ? 0 : -1;
+}
+
+static long memTell(GifInfo *info)
+{
+	return DGifTellMem(info->gifFilePtr);
 }
 
 static int getComment(GifByteType* Bytes, char** cmt)
@@ -217,30 +582,191 @@ static void getColorFromTable(int idx, argb* dst, const ColorMapObject* cmap)
 	packARGB32(dst, 0xFF, col->Red, col->Green,col->Blue);
 }
 
-static void eraseColor(argb* bm, int w, int h, argb color)
+static void copyLineScalar(argb* dst, const GifByteType* src,
+		const argb* colorTable, int transparent, int width)
 {
-	int i;
-	for (i = 0; i < w * h; i++)
-		*(bm + i) = color;
+	if (transparent < 0)
+	{
+		for (; width > 0; width--, src++, dst++)
+			*dst = colorTable[*src];
+		return;
+	}
+	for (; width > 0; width--, src++, dst++)
+	{
+		const argb color = colorTable[*src];
+		if (color.alpha != 0)
+			*dst = color;
+	}
 }
 
-static inline bool setupBackupBmp(GifInfo* info, int transpIndex)
+static void fillScalar(argb* dst, argb color, int count)
 {
-	GifFileType* fGIF = info->gifFilePtr;
-	info->backupPtr = calloc((size_t) (fGIF->SWidth * fGIF->SHeight), sizeof(argb));
-	if (!info->backupPtr)
+	for (; count > 0; count--, dst++)
+		*dst = color;
+}
+
+#ifdef GIF_SIMD_X86
+/**
+ * Skips runs of 16 transparent pixels, stores other runs of 16 without
+ * per pixel checks if none of them is transparent.
+ */
+static void copyLineSse2(argb* dst, const GifByteType* src,
+		const argb* colorTable, int transparent, int width)
+{
+	if (transparent < 0)
 	{
-		info->gifFilePtr->Error = D_GIF_ERR_NOT_ENOUGH_MEM;
-		return false;
+		copyLineScalar(dst, src, colorTable, transparent, width);
+		return;
 	}
-	argb paintingColor;
-	if (transpIndex == -1)
-		getColorFromTable(fGIF->SBackGroundColor, &paintingColor,
-				fGIF->SColorMap);
-	else
-		packARGB32(&paintingColor, 0, 0, 0, 0);
-	eraseColor(info->backupPtr, fGIF->SWidth, fGIF->SHeight, paintingColor);
-	return true;
+	const __m128i transp = _mm_set1_epi8((char) transparent);
+	int x, i;
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		const __m128i idx = _mm_loadu_si128((const __m128i*) (src + x));
+		const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(idx, transp));
+		if (mask == 0xFFFF)
+			continue;
+		if (mask == 0)
+			for (i = 0; i < 16; i++)
+				dst[x + i] = colorTable[src[x + i]];
+		else
+			for (i = 0; i < 16; i++)
+				if (!(mask & (1 << i)))
+					dst[x + i] = colorTable[src[x + i]];
+	}
+	copyLineScalar(dst + x, src + x, colorTable, transparent, width - x);
+}
+
+static void fillSse2(argb* dst, argb color, int count)
+{
+	uint32_t c;
+	memcpy(&c, &color, sizeof(c));
+	const __m128i v = _mm_set1_epi32((int) c);
+	for (; count >= 4; count -= 4, dst += 4)
+		_mm_storeu_si128((__m128i*) dst, v);
+	fillScalar(dst, color, count);
+}
+
+/**
+ * Looks up colors of 8 pixels at once, storing only non transparent ones.
+ */
+__attribute__((target("avx2")))
+static void copyLineAvx2(argb* dst, const GifByteType* src,
+		const argb* colorTable, int transparent, int width)
+{
+	const int* table = (const int*) colorTable;
+	const __m256i transp = _mm256_set1_epi32(transparent);
+	const __m256i transp8 = _mm256_set1_epi8((char) transparent);
+	int x = 0;
+	while (x + 8 <= width)
+	{
+		if (transparent >= 0 && x + 32 <= width)
+		{
+			const __m256i idx = _mm256_loadu_si256((const __m256i*) (src + x));
+			if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(idx, transp8)) == -1)
+			{
+				x += 32;
+				continue;
+			}
+		}
+		const __m256i idx = _mm256_cvtepu8_epi32(
+				_mm_loadl_epi64((const __m128i*) (src + x)));
+		const __m256i colors = _mm256_i32gather_epi32(table, idx, 4);
+		const __m256i transpLanes = _mm256_cmpeq_epi32(idx, transp);
+		if (_mm256_testz_si256(transpLanes, transpLanes))
+			_mm256_storeu_si256((__m256i*) (dst + x), colors);
+		else
+			_mm256_maskstore_epi32((int*) (dst + x),
+					_mm256_xor_si256(transpLanes, _mm256_set1_epi32(-1)), colors);
+		x += 8;
+	}
+	copyLineScalar(dst + x, src + x, colorTable, transparent, width - x);
+}
+
+__attribute__((target("avx2")))
+static void fillAvx2(argb* dst, argb color, int count)
+{
+	uint32_t c;
+	memcpy(&c, &color, sizeof(c));
+	const __m256i v = _mm256_set1_epi32((int) c);
+	for (; count >= 8; count -= 8, dst += 8)
+		_mm256_storeu_si256((__m256i*) dst, v);
+	fillScalar(dst, color, count);
+}
+#endif
+
+#ifdef GIF_SIMD_NEON
+/**
+ * Skips runs of 16 transparent pixels, stores other runs of 16 without
+ * per pixel checks if none of them is transparent.
+ */
+static void copyLineNeon(argb* dst, const GifByteType* src,
+		const argb* colorTable, int transparent, int width)
+{
+	if (transparent < 0)
+	{
+		copyLineScalar(dst, src, colorTable, transparent, width);
+		return;
+	}
+	const uint8x16_t transp = vdupq_n_u8((uint8_t) transparent);
+	int x, i;
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		const uint8x16_t eq = vceqq_u8(vld1q_u8(src + x), transp);
+		const uint64x2_t halves = vreinterpretq_u64_u8(eq);
+		const uint64_t lo = vgetq_lane_u64(halves, 0);
+		const uint64_t hi = vgetq_lane_u64(halves, 1);
+		if ((lo & hi) == UINT64_MAX)
+			continue;
+		if ((lo | hi) == 0)
+			for (i = 0; i < 16; i++)
+				dst[x + i] = colorTable[src[x + i]];
+		else
+			copyLineScalar(dst + x, src + x, colorTable, transparent, 16);
+	}
+	copyLineScalar(dst + x, src + x, colorTable, transparent, width - x);
+}
+
+static void fillNeon(argb* dst, argb color, int count)
+{
+	uint32_t c;
+	memcpy(&c, &color, sizeof(c));
+	const uint32x4_t v = vdupq_n_u32(c);
+	for (; count >= 4; count -= 4, dst += 4)
+		vst1q_u32((uint32_t*) dst, v);
+	fillScalar(dst, color, count);
+}
+#endif
+
+/**
+ * Converts palette indices to colors, skipping transparent ones
+ */
+static CopyLineFunc copyLine = copyLineScalar;
+/**
+ * Sets given number of pixels to color
+ */
+static FillFunc fillPixels = fillScalar;
+
+static void initKernels(void)
+{
+#if defined(GIF_SIMD_X86)
+	copyLine = copyLineSse2;
+	fillPixels = fillSse2;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		copyLine = copyLineAvx2;
+		fillPixels = fillAvx2;
+	}
+#elif defined(GIF_SIMD_NEON)
+	copyLine = copyLineNeon;
+	fillPixels = fillNeon;
+#endif
+}
+
+static void eraseColor(argb* bm, int w, int h, argb color)
+{
+	fillPixels(bm, color, w * h);
 }
 
 static int readExtensions(int ExtFunction, GifByteType* ExtData, GifInfo* info)
@@ -257,12 +783,6 @@ static int readExtensions(int ExtFunction, GifByteType* ExtData, GifInfo* info)
         fi->disposalMethod= (unsigned char) GCB.DisposalMode;
         fi->duration= GCB.DelayTime> 1 ? (unsigned int)GCB.DelayTime * 10 : 100;
         fi->transpIndex=GCB.TransparentColor;
-
-        if (fi->disposalMethod == DISPOSE_PREVIOUS && info->backupPtr == NULL)
-        {
-            if (!setupBackupBmp(info, fi->transpIndex))
-                return GIF_ERROR;
-        }
 	}
 	else if (ExtFunction == COMMENT_EXT_FUNC_CODE)
 	{
@@ -293,76 +813,296 @@ static int readExtensions(int ExtFunction, GifByteType* ExtData, GifInfo* info)
 	return GIF_OK;
 }
 
-static int DDGifSlurp(GifFileType* GifFile, GifInfo* info, bool shouldDecode)
+static argb*
+getAddr(argb* bm, int width, int left, int top)
 {
-	GifRecordType RecordType;
-	GifByteType* ExtData;
-	int codeSize;
-	int ExtFunction;
-	int ImageSize;
-	do
+	return bm + top * width + left;
+}
+
+/**
+ * Maps rect of the frame to canvas. Canvas pixel (x, y) comes from screen
+ * pixel (x * sampleSize, y * sampleSize), rect is clipped to canvas and may be
+ * empty.
+ */
+static void getCanvasRect(const GifInfo* info, const GifImageDesc* desc,
+		GifWord* left, GifWord* top, GifWord* right, GifWord* bottom)
+{
+	const GifFileType* fGif = info->gifFilePtr;
+	const int k = info->sampleSize;
+	*left = desc->Left < fGif->SWidth ? desc->Left : fGif->SWidth;
+	*top = desc->Top < fGif->SHeight ? desc->Top : fGif->SHeight;
+	*right = desc->Left + desc->Width < fGif->SWidth ?
+			desc->Left + desc->Width : fGif->SWidth;
+	*bottom = desc->Top + desc->Height < fGif->SHeight ?
+			desc->Top + desc->Height : fGif->SHeight;
+	if (k == 1)
+		return;
+	*left = (*left + k - 1) / k;
+	*top = (*top + k - 1) / k;
+	*right = (*right + k - 1) / k;
+	*bottom = (*bottom + k - 1) / k;
+}
+
+/**
+ * Allocates backup large enough for canvas area under any frame disposed to
+ * previous, only that area is saved before such frame is drawn.
+ */
+static bool setupBackupBmp(GifInfo* info)
+{
+	const GifFileType* fGif = info->gifFilePtr;
+	size_t capacity = 0;
+	int i;
+	for (i = 0; i < fGif->ImageCount; i++)
+	{
+		if (info->infos[i].disposalMethod != DISPOSE_PREVIOUS)
+			continue;
+		GifWord left, top, right, bottom;
+		getCanvasRect(info, &fGif->SavedImages[i].ImageDesc, &left, &top,
+				&right, &bottom);
+		if (right > left && bottom > top
+				&& (size_t) (right - left) * (bottom - top) > capacity)
+			capacity = (size_t) (right - left) * (bottom - top);
+	}
+	if (capacity == 0)
+		return true;
+	info->backupPtr = malloc(capacity * sizeof(argb));
+	if (info->backupPtr == NULL)
+		return false;
+	info->backupCapacity = capacity;
+	return true;
+}
+
+/**
+ * Copies canvas area under frame idx to backup, rows packed one after another,
+ * or back to canvas if restore is true.
+ */
+static void copyBackupRect(const GifInfo* info, argb* bm, int idx, bool restore)
+{
+	GifWord left, top, right, bottom;
+	getCanvasRect(info, &info->gifFilePtr->SavedImages[idx].ImageDesc, &left,
+			&top, &right, &bottom);
+	if (right <= left || bottom <= top)
+		return;
+	const size_t rowBytes = (right - left) * sizeof(argb);
+	argb* backup = info->backupPtr;
+	argb* canvas = bm + top * info->width + left;
+	for (; top < bottom; top++, canvas += info->width, backup += right - left)
+	{
+		if (restore)
+			memcpy(canvas, backup, rowBytes);
+		else
+			memcpy(backup, canvas, rowBytes);
+	}
+}
+
+/**
+ * Like copyLine but takes every sampleSize-th index of the line.
+ */
+static void copyCanvasLine(const GifInfo* info, argb* dst,
+		const GifByteType* src, const argb* colorTable, int transparent,
+		int width)
+{
+	const int k = info->sampleSize;
+	if (k == 1)
+	{
+		copyLine(dst, src, colorTable, transparent, width);
+		return;
+	}
+	for (; width > 0; width--, src += k, dst++)
+	{
+		const argb color = colorTable[*src];
+		if (transparent < 0 || color.alpha != 0)
+			*dst = color;
+	}
+}
+
+/*
+ * The way an interlaced image should be read -
+ * offsets and jumps...
+ */
+static const int InterlacedOffset[] =
+{ 0, 4, 2, 1 };
+static const int InterlacedJumps[] =
+{ 8, 8, 4, 2 };
+
+#if !defined(DECODE_TO_CANVAS) || MAX_DECODE_THREADS > 0
+/**
+ * Decodes whole index raster of the current image, in display order.
+ */
+static int decodeRaster(GifFileType* GifFile, const GifImageDesc* desc,
+		GifByteType* raster)
+{
+	int i, j;
+	if (!desc->Interlace)
+		return DGifGetLine(GifFile, raster, desc->Width * desc->Height);
+	/* Need to perform 4 passes on the image */
+	for (i = 0; i < 4; i++)
+		for (j = InterlacedOffset[i]; j < desc->Height; j += InterlacedJumps[i])
+		{
+			if (DGifGetLine(GifFile, raster + j * desc->Width,
+					desc->Width) == GIF_ERROR)
+				return GIF_ERROR;
+		}
+	return GIF_OK;
+}
+#endif
+
+static int decodeFrame(GifFileType* GifFile, GifInfo* info, SavedImage* sp,
+		argb* bm)
+{
+	TRACE_SCOPE(info, "decode");
+#ifdef DECODE_TO_CANVAS
+	const int passes = sp->ImageDesc.Interlace ? 4 : 1;
+	int i, j;
+	const argb* colorTable = info->infos[info->currentIndex].colorTable;
+	const int transpIndex = info->infos[info->currentIndex].transpIndex;
+	const int k = info->sampleSize;
+	GifWord left, top, right, bottom;
+	getCanvasRect(info, &sp->ImageDesc, &left, &top, &right, &bottom);
+	//lines are decoded in full, only those falling on canvas rows are copied
+	const GifByteType* src = info->rasterBits + left * k - sp->ImageDesc.Left;
+
+	for (i = 0; i < passes; i++)
+		for (j = passes == 1 ? 0 : InterlacedOffset[i]; j < sp->ImageDesc.Height;
+				j += passes == 1 ? 1 : InterlacedJumps[i])
+		{
+			if (DGifGetLine(GifFile, info->rasterBits,
+					sp->ImageDesc.Width) == GIF_ERROR)
+				return GIF_ERROR;
+			const GifWord y = sp->ImageDesc.Top + j;
+			if (y % k == 0 && y / k < bottom && right > left)
+				copyCanvasLine(info, getAddr(bm, info->width, left, y / k), src,
+						colorTable, transpIndex, right - left);
+		}
+	return GIF_OK;
+#else
+	sp->RasterBits = info->rasterBits;
+	return decodeRaster(GifFile, &sp->ImageDesc, sp->RasterBits);
+#endif
+}
+
+static void initFrameInfo(FrameInfo* fi)
+{
+	fi->duration = 0;
+	fi->disposalMethod = DISPOSAL_UNSPECIFIED;
+	fi->transpIndex = NO_TRANSPARENT_COLOR;
+	fi->descPos = -1;
+	fi->dataPos = -1;
+	fi->colorTable = NULL;
+}
+
+static int checkFrameDims(GifFileType* GifFile, const SavedImage* sp)
+{
+	const int ImageSize = sp->ImageDesc.Width * sp->ImageDesc.Height;
+
+	if (sp->ImageDesc.Width < 1 || sp->ImageDesc.Height < 1
+			|| ImageSize > (SIZE_MAX / sizeof(GifPixelType)))
+	{
+		GifFile->Error = D_GIF_ERR_INVALID_IMG_DIMS;
+		return GIF_ERROR;
+	}
+	if (sp->ImageDesc.Width > GifFile->SWidth
+			|| sp->ImageDesc.Height > GifFile->SHeight)
+	{
+		GifFile->Error = D_GIF_ERR_IMG_NOT_CONFINED;
+		return GIF_ERROR;
+	}
+	return GIF_OK;
+}
+
+/**
+ * Decodes current frame by seeking directly to its LZW data recorded during
+ * metadata pass, so extensions and descriptors are not parsed again. Next loop
+ * starts from the first frame data as well, input is never rewound.
+ */
+static int decodeIndexedFrame(GifFileType* GifFile, GifInfo* info, argb* bm)
+{
+	SavedImage* sp = &GifFile->SavedImages[info->currentIndex];
+	if (checkFrameDims(GifFile, sp) == GIF_ERROR)
+		return GIF_ERROR;
+	if (info->seekFunction(info, info->infos[info->currentIndex].dataPos) != 0)
+	{
+		GifFile->Error = D_GIF_ERR_READ_FAILED;
+		return GIF_ERROR;
+	}
+	if (DGifStartImage(GifFile, &sp->ImageDesc) == GIF_ERROR
+			|| decodeFrame(GifFile, info, sp, bm) == GIF_ERROR)
+		return GIF_ERROR;
+	if (info->currentIndex >= GifFile->ImageCount - 1 && info->loopCount > 0)
+		info->currentLoop++;
+	return GIF_OK;
+}
+
+/**
+ * Returns function skipping bytes of non-memory input, NULL if they have to be
+ * read. Memory inputs are skipped by DGifSkipCode itself. Stdio files are read
+ * since fseek may cost a system call per sub-block.
+ */
+static SkipFunc getSkipFunction(const GifInfo* info)
+{
+	return info->rewindFunction == streamRewind ? streamSkipFun : NULL;
+}
+
+static int DDGifSlurp(GifFileType* GifFile, GifInfo* info, bool shouldDecode,
+		argb* bm)
+{
+	GifRecordType RecordType;
+	GifByteType* ExtData;
+	int ExtFunction;
+	long descPos = -1;
+	if (shouldDecode && info->seekFunction != NULL)
+		return decodeIndexedFrame(GifFile, info, bm);
+	do
 	{
 		if (DGifGetRecordType(GifFile, &RecordType) == GIF_ERROR)
 			return (GIF_ERROR);
+		TRACE_SCOPE(info, getRecordName(RecordType));
 		switch (RecordType)
 		{
 		case IMAGE_DESC_RECORD_TYPE:
 
+			if (!shouldDecode && info->tellFunction != NULL)
+				descPos = info->tellFunction(info);
 			if (DGifGetImageDesc(GifFile, !shouldDecode) == GIF_ERROR)
 				return (GIF_ERROR);
 			SavedImage* sp = &GifFile->SavedImages[(shouldDecode ? info->currentIndex : GifFile->ImageCount - 1)];
-			ImageSize = sp->ImageDesc.Width * sp->ImageDesc.Height;
-
-			if (sp->ImageDesc.Width < 1 || sp->ImageDesc.Height < 1
-					|| ImageSize > (SIZE_MAX / sizeof(GifPixelType)))
+			if (shouldDecode)
 			{
-				GifFile->Error = D_GIF_ERR_INVALID_IMG_DIMS;
-				return GIF_ERROR;
+				//descriptor is also copied past the last frame, colors come from color tables
+				SavedImage* scratch = &GifFile->SavedImages[GifFile->ImageCount];
+				GifFreeMapObject(scratch->ImageDesc.ColorMap);
+				scratch->ImageDesc.ColorMap = NULL;
 			}
-			if (sp->ImageDesc.Width > GifFile->SWidth
-					|| sp->ImageDesc.Height > GifFile->SHeight)
+			else
 			{
-				GifFile->Error = D_GIF_ERR_IMG_NOT_CONFINED;
-				return GIF_ERROR;
+				FrameInfo* fi = &info->infos[GifFile->ImageCount - 1];
+				fi->descPos = descPos;
+				//code size byte has been consumed along with descriptor
+				fi->dataPos = info->tellFunction != NULL ? info->tellFunction(info) - 1 : -1;
+				if (descPos < 0 || fi->dataPos < 0)
+					info->seekFunction = NULL;
+				//GCB of the next frame, if any, is stored in the next entry
+				FrameInfo* tmpInfos = realloc(info->infos,
+						(GifFile->ImageCount + 1) * sizeof(FrameInfo));
+				if (tmpInfos == NULL)
+				{
+					GifFile->Error = D_GIF_ERR_NOT_ENOUGH_MEM;
+					return GIF_ERROR;
+				}
+				info->infos = tmpInfos;
+				initFrameInfo(&info->infos[GifFile->ImageCount]);
 			}
+			if (checkFrameDims(GifFile, sp) == GIF_ERROR)
+				return GIF_ERROR;
 			if (shouldDecode)
 			{
-
-				sp->RasterBits = info->rasterBits;
-
-				if (sp->ImageDesc.Interlace)
-				{
-					int i, j;
-					/*
-					 * The way an interlaced image should be read -
-					 * offsets and jumps...
-					 */
-					int InterlacedOffset[] =
-					{ 0, 4, 2, 1 };
-					int InterlacedJumps[] =
-					{ 8, 8, 4, 2 };
-					/* Need to perform 4 passes on the image */
-					for (i = 0; i < 4; i++)
-						for (j = InterlacedOffset[i]; j < sp->ImageDesc.Height;
-								j += InterlacedJumps[i])
-						{
-							if (DGifGetLine(GifFile,
-									sp->RasterBits + j * sp->ImageDesc.Width,
-									sp->ImageDesc.Width) == GIF_ERROR)
-								return GIF_ERROR;
-						}
-				}
-				else
-				{
-					if (DGifGetLine(GifFile, sp->RasterBits,
-							ImageSize) == GIF_ERROR)
-						return (GIF_ERROR);
-				}
+				if (decodeFrame(GifFile, info, sp, bm) == GIF_ERROR)
+					return GIF_ERROR;
 				if (info->currentIndex >= GifFile->ImageCount - 1)
 				{
 					if (info->loopCount > 0)
 						info->currentLoop++;
-					if (info->rewindFunction(info) != 0)
+					if (rewindInput(info) != 0)
 					{
 						info->gifFilePtr->Error = D_GIF_ERR_REWIND_FAILED;
 						return GIF_ERROR;
@@ -372,13 +1112,9 @@ static int DDGifSlurp(GifFileType* GifFile, GifInfo* info, bool shouldDecode)
 			}
 			else
 			{
-				if (DGifGetCode(GifFile, &codeSize, &ExtData) == GIF_ERROR)
+				//LZW data is only needed when frame is decoded
+				if (DGifSkipCode(GifFile, getSkipFunction(info)) == GIF_ERROR)
 					return (GIF_ERROR);
-				while (ExtData != NULL)
-				{
-					if (DGifGetCodeNext(GifFile, &ExtData) == GIF_ERROR)
-						return (GIF_ERROR);
-				}
 			}
 			break;
 
@@ -388,11 +1124,6 @@ static int DDGifSlurp(GifFileType* GifFile, GifInfo* info, bool shouldDecode)
 
 			if (!shouldDecode)
 			{
-				FrameInfo* tmpInfos = realloc(info->infos,
-						(GifFile->ImageCount + 1) * sizeof(FrameInfo));
-                if (tmpInfos==NULL)
-                    return GIF_ERROR;
-                info->infos=tmpInfos;
 				if (readExtensions(ExtFunction, ExtData, info) == GIF_ERROR)
 					return GIF_ERROR;
 			}
@@ -419,7 +1150,7 @@ static int DDGifSlurp(GifFileType* GifFile, GifInfo* info, bool shouldDecode)
 	bool ok = true;
 	if (shouldDecode)
 	{
-		ok = (info->rewindFunction(info) == 0);
+		ok = (rewindInput(info) == 0);
 	}
 	if (ok)
 		return (GIF_OK);
@@ -430,6 +1161,75 @@ static int DDGifSlurp(GifFileType* GifFile, GifInfo* info, bool shouldDecode)
 	}
 }
 
+/**
+ * Returns table of given colors with transparent entry marked, reusing
+ * identical one if it already exists. Indices beyond color count get the first color.
+ */
+static const argb* getColorTable(GifInfo* info, const ColorMapObject* cmap,
+		int transpIndex)
+{
+	ColorTable table;
+	int i;
+	for (i = 0; i < 256; i++)
+	{
+		const GifColorType* col = &cmap->Colors[i < cmap->ColorCount ? i : 0];
+		packARGB32(&table.colors[i], 0xFF, col->Red, col->Green, col->Blue);
+	}
+	if (transpIndex >= 0 && transpIndex < 256)
+		packARGB32(&table.colors[transpIndex], 0, 0, 0, 0);
+
+	//FNV-1a
+	const uint8_t* bytes = (const uint8_t*) table.colors;
+	table.hash = 2166136261U;
+	for (i = 0; i < (int) sizeof(table.colors); i++)
+		table.hash = (table.hash ^ bytes[i]) * 16777619U;
+
+	for (i = 0; i < info->colorTableCount; i++)
+	{
+		const ColorTable* t = info->colorTables[i];
+		if (t->hash == table.hash
+				&& memcmp(t->colors, table.colors, sizeof(table.colors)) == 0)
+			return t->colors;
+	}
+
+	ColorTable** tmpTables = realloc(info->colorTables,
+			(info->colorTableCount + 1) * sizeof(ColorTable*));
+	if (tmpTables == NULL)
+		return NULL;
+	info->colorTables = tmpTables;
+	ColorTable* newTable = malloc(sizeof(ColorTable));
+	if (newTable == NULL)
+		return NULL;
+	*newTable = table;
+	info->colorTables[info->colorTableCount++] = newTable;
+	return newTable->colors;
+}
+
+/**
+ * Converts color maps of all frames to color tables. Local color maps are
+ * not needed afterwards so they are freed.
+ */
+static bool buildColorTables(GifInfo* info)
+{
+	GifFileType* GifFile = info->gifFilePtr;
+	int i;
+	for (i = 0; i < GifFile->ImageCount; i++)
+	{
+		SavedImage* sp = &GifFile->SavedImages[i];
+		info->infos[i].colorTable = getColorTable(info,
+				getFrameColorMap(sp, GifFile->SColorMap),
+				info->infos[i].transpIndex);
+		if (info->infos[i].colorTable == NULL)
+			return false;
+		if (sp->ImageDesc.ColorMap != NULL)
+		{
+			GifFreeMapObject(sp->ImageDesc.ColorMap);
+			sp->ImageDesc.ColorMap = NULL;
+		}
+	}
+	return true;
+}
+
 static void setMetaData(int width, int height, int ImageCount, int errorCode,
 		JNIEnv * env, jintArray metaData)
 {
@@ -457,8 +1257,23 @@ static void setMetaData(int width, int height, int ImageCount, int errorCode,
 		(*env)->Throw(env, exception);
 }
 
-static GifInfo* open(GifFileType* GifFileIn, int Error, long startPos,
-		RewindFunc rewindFunc, JNIEnv * env, jintArray metaData, const jboolean justDecodeMetaData)
+static void setOpenMetaData(RenderMetaData* meta, int width, int height,
+		int ImageCount, int errorCode)
+{
+	meta->width = width;
+	meta->height = height;
+	meta->imageCount = ImageCount;
+	meta->errorCode = errorCode;
+}
+
+/**
+ * Reads metadata of opened GIF and sets up its decoding. Screen dimensions,
+ * frame count and error code are stored in meta.
+ * @return NULL on error, GifFileIn is closed then
+ */
+static GifInfo* openGif(GifFileType* GifFileIn, int Error, long startPos,
+		RewindFunc rewindFunc, SeekFunc seekFunc, TellFunc tellFunc,
+		bool justDecodeMetaData, int sampleSize, RenderMetaData* meta)
 {
 	if (startPos < 0)
 	{
@@ -467,7 +1282,7 @@ static GifInfo* open(GifFileType* GifFileIn, int Error, long startPos,
 	}
 	if (Error != 0 || GifFileIn == NULL)
 	{
-		setMetaData(0, 0, 0, Error, env, metaData);
+		setOpenMetaData(meta, 0, 0, 0, Error);
 		return NULL;
 	}
 	int width = GifFileIn->SWidth, height = GifFileIn->SHeight;
@@ -475,19 +1290,20 @@ static GifInfo* open(GifFileType* GifFileIn, int Error, long startPos,
 	if (wxh < 1 || wxh > INT_MAX)
 	{
 		DGifCloseFile(GifFileIn);
-		setMetaData(width, height, 0,
-		D_GIF_ERR_INVALID_SCR_DIMS, env, metaData);
+		setOpenMetaData(meta, width, height, 0, D_GIF_ERR_INVALID_SCR_DIMS);
 		return NULL;
 	}
 	GifInfo* info = malloc(sizeof(GifInfo));
 	if (info == NULL)
 	{
 		DGifCloseFile(GifFileIn);
-		setMetaData(width, height, 0,
-		D_GIF_ERR_NOT_ENOUGH_MEM, env, metaData);
+		setOpenMetaData(meta, width, height, 0, D_GIF_ERR_NOT_ENOUGH_MEM);
 		return NULL;
 	}
 	info->gifFilePtr = GifFileIn;
+	info->sampleSize = sampleSize > 1 ? sampleSize : 1;
+	width = info->width = (width + info->sampleSize - 1) / info->sampleSize;
+	height = info->height = (height + info->sampleSize - 1) / info->sampleSize;
 	info->startPos = startPos;
 	info->currentIndex = -1;
 	info->nextStartTime = 0;
@@ -496,25 +1312,51 @@ static GifInfo* open(GifFileType* GifFileIn, int Error, long startPos,
 	info->loopCount = 0;
 	info->currentLoop = -1;
 	info->speedFactor = 1.0;
-	if (justDecodeMetaData == JNI_TRUE)
+	info->framePolicy = FRAME_POLICY_DELAY;
+	if (justDecodeMetaData)
 	    info->rasterBits=NULL;
 	else
+#ifdef DECODE_TO_CANVAS
+	    info->rasterBits = calloc((size_t) GifFileIn->SWidth, sizeof(GifPixelType));
+#else
 	    info->rasterBits = calloc((size_t) (GifFileIn->SHeight * GifFileIn->SWidth),
 			sizeof(GifPixelType));
+#endif
 	info->infos = malloc(sizeof(FrameInfo));
+	info->frameStartTimes = NULL;
+	info->checkpoints = NULL;
+	info->checkpointCount = 0;
+	info->checkpointInterval = 0;
+	info->replayFrames = NULL;
+	info->replayFrameCount = 0;
+	info->replayBytes = 0;
+	info->replayBudget = 0;
+	info->replayPalettes = NULL;
+	info->replayPaletteCount = 0;
+	info->colorTables = NULL;
+	info->colorTableCount = 0;
 	info->backupPtr = NULL;
+	info->backupCapacity = 0;
 	info->rewindFunction = rewindFunc;
-
-	if ((info->rasterBits == NULL && justDecodeMetaData != JNI_TRUE) || info->infos == NULL)
+	info->seekFunction = seekFunc;
+	info->tellFunction = tellFunc;
+	info->frameBuffer = NULL;
+	info->metaDataBuffer = NULL;
+	info->frameBufferPixels = NULL;
+	info->frameBufferMetaData = NULL;
+	info->decodeAhead = NULL;
+	info->parallelBytes = 0;
+	memset(&info->stats, 0, sizeof(info->stats));
+	TRACE_BEGIN(info, "open");
+
+	if ((info->rasterBits == NULL && !justDecodeMetaData) || info->infos == NULL)
 	{
+		TRACE_END(info, "open");
 		cleanUp(info);
-		setMetaData(width, height, 0,
-		D_GIF_ERR_NOT_ENOUGH_MEM, env, metaData);
+		setOpenMetaData(meta, width, height, 0, D_GIF_ERR_NOT_ENOUGH_MEM);
 		return NULL;
 	}
-	info->infos->duration = 0;
-	info->infos->disposalMethod = DISPOSAL_UNSPECIFIED;
-	info->infos->transpIndex = NO_TRANSPARENT_COLOR;
+	initFrameInfo(info->infos);
 	if (GifFileIn->SColorMap == NULL
 			|| GifFileIn->SColorMap->ColorCount
 					!= (1 << GifFileIn->SColorMap->BitsPerPixel))
@@ -523,29 +1365,122 @@ static GifInfo* open(GifFileType* GifFileIn, int Error, long startPos,
 		GifFileIn->SColorMap = defaultCmap;
 	}
 
+	TRACE_BEGIN(info, "metadata");
 #if defined(STRICT_FORMAT_89A)
-	if (DDGifSlurp(GifFileIn, info, false) == GIF_ERROR)
+	if (DDGifSlurp(GifFileIn, info, false, NULL) == GIF_ERROR)
 		Error = GifFileIn->Error;
 #else
-	DDGifSlurp(GifFileIn, info, false);
+	DDGifSlurp(GifFileIn, info, false, NULL);
 #endif
+	TRACE_END(info, "metadata");
 
 	int imgCount = GifFileIn->ImageCount;
 
 	if (imgCount < 1)
 		Error = D_GIF_ERR_NO_FRAMES;
-	if (info->rewindFunction(info) != 0)
+	else if (!justDecodeMetaData
+			&& (!buildColorTables(info) || !setupBackupBmp(info)))
+		Error = D_GIF_ERR_NOT_ENOUGH_MEM;
+	else
+	{
+		info->frameStartTimes = malloc((imgCount + 1) * sizeof(unsigned long));
+		if (info->frameStartTimes == NULL)
+			Error = D_GIF_ERR_NOT_ENOUGH_MEM;
+		else
+		{
+			int i;
+			info->frameStartTimes[0] = 0;
+			for (i = 0; i < imgCount; i++)
+				info->frameStartTimes[i + 1] = info->frameStartTimes[i]
+						+ info->infos[i].duration;
+		}
+	}
+	//frames are seeked to directly, position is only relevant for sequential decoding
+	if (info->seekFunction == NULL && rewindInput(info) != 0)
 		Error = D_GIF_ERR_READ_FAILED;
+	TRACE_END(info, "open");
 	if (Error != 0)
 		cleanUp(info);
-	setMetaData(width, height, imgCount, Error, env, metaData);
+	setOpenMetaData(meta, width, height, imgCount, Error);
 
 	return Error == 0 ? info : NULL;
 }
 
+static GifInfo* open(GifFileType* GifFileIn, int Error, long startPos,
+		RewindFunc rewindFunc, SeekFunc seekFunc, TellFunc tellFunc,
+		JNIEnv * env, jintArray metaData, const jboolean justDecodeMetaData,
+		jint sampleSize)
+{
+	RenderMetaData meta;
+	GifInfo* info = openGif(GifFileIn, Error, startPos, rewindFunc, seekFunc,
+			tellFunc, justDecodeMetaData == JNI_TRUE, sampleSize, &meta);
+	setMetaData(meta.width, meta.height, meta.imageCount, meta.errorCode, env,
+			metaData);
+	return info;
+}
+
+GifInfo* openGifMemory(const GifByteType* data, unsigned long size,
+		bool justDecodeMetaData, int sampleSize, RenderMetaData* meta)
+{
+	int Error = 0;
+	TRACE_BEGIN(NULL, "header");
+	GifFileType* GifFileIn = DGifOpenMem(NULL, data, size, &Error);
+	TRACE_END(NULL, "header");
+	return openGif(GifFileIn, Error, GifFileIn == NULL ? 0 : DGifTellMem(GifFileIn),
+			directByteBufferRewindFun, memSeek, memTell, justDecodeMetaData,
+			sampleSize, meta);
+}
+
+/**
+ * Maps file from given offset to its end and reads it like a byte array.
+ * Returns false if file cannot be mapped, stdio has to be used then.
+ */
+static bool openMappedFile(int fd, long offset, JNIEnv * env,
+		jintArray metaData, jboolean justDecodeMetaData, jint sampleSize,
+		jlong* result)
+{
+	struct stat st;
+	if (offset < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+			|| st.st_size <= offset)
+		return false;
+	const long pageSize = sysconf(_SC_PAGESIZE);
+	const off_t mapStart = pageSize > 0 ? offset - offset % pageSize : 0;
+	if ((uint64_t) (st.st_size - mapStart) > SIZE_MAX)
+		return false;
+	MappedFileContainer* container = malloc(sizeof(MappedFileContainer));
+	if (container == NULL)
+		return false;
+	container->length = (size_t) (st.st_size - mapStart);
+	container->address = mmap(NULL, container->length, PROT_READ, MAP_PRIVATE,
+			fd, mapStart);
+	if (container->address == MAP_FAILED)
+	{
+		free(container);
+		return false;
+	}
+	//frames are read again on each loop, possibly by several threads, so whole file is worth prefetching
+	madvise(container->address, container->length, MADV_WILLNEED);
+
+	int Error = 0;
+	TRACE_BEGIN(NULL, "header");
+	GifFileType* GifFileIn = DGifOpenMem(container,
+			(GifByteType*) container->address + (offset - mapStart),
+			(unsigned long) (st.st_size - offset), &Error);
+	TRACE_END(NULL, "header");
+	GifInfo* openResult = open(GifFileIn, Error, GifFileIn == NULL ? 0 : DGifTellMem(GifFileIn),
+			mappedFileRewind, memSeek, memTell, env, metaData, justDecodeMetaData, sampleSize);
+	if (openResult == NULL)
+	{
+		munmap(container->address, container->length);
+		free(container);
+	}
+	*result = (jlong)(intptr_t) openResult;
+	return true;
+}
+
 JNIEXPORT jlong JNICALL
 Java_pl_droidsonroids_gif_GifDrawable_openFile(JNIEnv * env, jclass class,
-		jintArray metaData, jstring jfname, jboolean justDecodeMetaData)
+		jintArray metaData, jstring jfname, jboolean justDecodeMetaData, jint sampleSize)
 {
 	if (jfname == NULL)
 	{
@@ -563,14 +1498,22 @@ Java_pl_droidsonroids_gif_GifDrawable_openFile(JNIEnv * env, jclass class,
 		D_GIF_ERR_OPEN_FAILED, env, metaData);
 		return (jlong)(intptr_t) NULL;
 	}
+	jlong mapped;
+	if (openMappedFile(fileno(file), 0, env, metaData, justDecodeMetaData, sampleSize, &mapped))
+	{
+		fclose(file);
+		return mapped;
+	}
 	int Error = 0;
+	TRACE_BEGIN(NULL, "header");
 	GifFileType* GifFileIn = DGifOpen(file, &fileRead, &Error);
-	return (jlong)(intptr_t) open(GifFileIn, Error, ftell(file), fileRewind, env, metaData, justDecodeMetaData);
+	TRACE_END(NULL, "header");
+	return (jlong)(intptr_t) open(GifFileIn, Error, ftell(file), fileRewind, fileSeek, fileTell, env, metaData, justDecodeMetaData, sampleSize);
 }
 
 JNIEXPORT jlong JNICALL
 Java_pl_droidsonroids_gif_GifDrawable_openByteArray(JNIEnv * env, jclass class,
-		jintArray metaData, jbyteArray bytes, jboolean justDecodeMetaData)
+		jintArray metaData, jbyteArray bytes, jboolean justDecodeMetaData, jint sampleSize)
 {
 	ByteArrayContainer* container = malloc(sizeof(ByteArrayContainer));
 	if (container == NULL)
@@ -580,16 +1523,29 @@ Java_pl_droidsonroids_gif_GifDrawable_openByteArray(JNIEnv * env, jclass class,
 		return (jlong)(intptr_t) NULL;
 	}
 	container->buffer = (*env)->NewGlobalRef(env, bytes);
-	container->arrLen = (*env)->GetArrayLength(env, container->buffer);
-	container->pos = 0;
+	//array is pinned or copied once, then parsed in place
+	container->bytes = (*env)->GetByteArrayElements(env, container->buffer, NULL);
+	if (container->bytes == NULL)
+	{
+		(*env)->DeleteGlobalRef(env, container->buffer);
+		free(container);
+		setMetaData(0, 0, 0,
+		D_GIF_ERR_NOT_ENOUGH_MEM, env, metaData);
+		return (jlong)(intptr_t) NULL;
+	}
+	jsize arrLen = (*env)->GetArrayLength(env, container->buffer);
 	int Error = 0;
-	GifFileType* GifFileIn = DGifOpen(container, &byteArrayReadFun, &Error);
+	TRACE_BEGIN(NULL, "header");
+	GifFileType* GifFileIn = DGifOpenMem(container, (GifByteType*) container->bytes,
+			(unsigned long) arrLen, &Error);
+	TRACE_END(NULL, "header");
 
-	GifInfo* openResult = open(GifFileIn, Error, container->pos, byteArrayRewind,
-            env, metaData, justDecodeMetaData);
+	GifInfo* openResult = open(GifFileIn, Error, GifFileIn == NULL ? 0 : DGifTellMem(GifFileIn),
+			byteArrayRewind, memSeek, memTell, env, metaData, justDecodeMetaData, sampleSize);
 
 	if (openResult == NULL)
 	{
+		(*env)->ReleaseByteArrayElements(env, container->buffer, container->bytes, JNI_ABORT);
 		(*env)->DeleteGlobalRef(env, container->buffer);
 		free(container);
 		container=NULL;
@@ -599,7 +1555,7 @@ Java_pl_droidsonroids_gif_GifDrawable_openByteArray(JNIEnv * env, jclass class,
 
 JNIEXPORT jlong JNICALL
 Java_pl_droidsonroids_gif_GifDrawable_openDirectByteBuffer(JNIEnv * env,
-		jclass class, jintArray metaData, jobject buffer, jboolean justDecodeMetaData)
+		jclass class, jintArray metaData, jobject buffer, jboolean justDecodeMetaData, jint sampleSize)
 {
 	jbyte* bytes = (*env)->GetDirectBufferAddress(env, buffer);
 	jlong capacity = (*env)->GetDirectBufferCapacity(env, buffer);
@@ -609,35 +1565,19 @@ Java_pl_droidsonroids_gif_GifDrawable_openDirectByteBuffer(JNIEnv * env,
 		D_GIF_ERR_OPEN_FAILED, env, metaData);
 		return (jlong)(intptr_t) NULL;
 	}
-	DirectByteBufferContainer* container = malloc(
-			sizeof(DirectByteBufferContainer));
-	if (container == NULL)
-	{
-		setMetaData(0, 0, 0,
-		D_GIF_ERR_NOT_ENOUGH_MEM, env, metaData);
-		return (jlong)(intptr_t) NULL;
-	}
-	container->bytes = bytes;
-	container->capacity = capacity;
-	container->pos = 0;
 	int Error = 0;
-	GifFileType* GifFileIn = DGifOpen(container, &directByteBufferReadFun,
-			&Error);
-
-	GifInfo* openResult = open(GifFileIn, Error, container->pos,
-			directByteBufferRewindFun, env, metaData, justDecodeMetaData);
+	TRACE_BEGIN(NULL, "header");
+	GifFileType* GifFileIn = DGifOpenMem(NULL, (GifByteType*) bytes,
+			(unsigned long) capacity, &Error);
+	TRACE_END(NULL, "header");
 
-	if (openResult == NULL)
-	{
-		free(container);
-		container=NULL;
-    }
-	return (jlong)(intptr_t) openResult;
+	return (jlong)(intptr_t) open(GifFileIn, Error, GifFileIn == NULL ? 0 : DGifTellMem(GifFileIn),
+			directByteBufferRewindFun, memSeek, memTell, env, metaData, justDecodeMetaData, sampleSize);
 }
 
 JNIEXPORT jlong JNICALL
 Java_pl_droidsonroids_gif_GifDrawable_openStream(JNIEnv * env, jclass class,
-		jintArray metaData, jobject stream, jboolean justDecodeMetaData)
+		jintArray metaData, jobject stream, jboolean justDecodeMetaData, jint sampleSize)
 {
 	jclass streamCls = (*env)->NewGlobalRef(env,
 			(*env)->GetObjectClass(env, stream));
@@ -666,17 +1606,31 @@ Java_pl_droidsonroids_gif_GifDrawable_openStream(JNIEnv * env, jclass class,
 	container->stream = (*env)->NewGlobalRef(env, stream);
 	container->streamCls = streamCls;
 	container->buffer = NULL;
+	container->data = NULL;
+	container->dataLength = 0;
+	container->dataCapacity = 0;
+	container->dataPos = 0;
+	container->dataStart = 0;
+	container->spooled = STREAM_SPOOL_MAX_BYTES > 0;
+	container->eof = false;
+
+	//stream is read ahead, so it is reset to its beginning and read up to desired position
+	(*env)->CallVoidMethod(env, stream, mid, INT_MAX);
 
 	int Error = 0;
+	TRACE_BEGIN(NULL, "header");
 	GifFileType* GifFileIn = DGifOpen(container, &streamReadFun, &Error);
+	TRACE_END(NULL, "header");
 
-	(*env)->CallVoidMethod(env, stream, mid, LONG_MAX); //TODO better length?
-
-	GifInfo* openResult = open(GifFileIn, Error, 0, streamRewind, env, metaData, justDecodeMetaData);
+	GifInfo* openResult = open(GifFileIn, Error, container->dataStart + (long) container->dataPos,
+			streamRewind, streamSeek, streamTell, env, metaData, justDecodeMetaData, sampleSize);
 	if (openResult == NULL)
 	{
 		(*env)->DeleteGlobalRef(env, streamCls);
 		(*env)->DeleteGlobalRef(env, container->stream);
+		if (container->buffer != NULL)
+			(*env)->DeleteGlobalRef(env, container->buffer);
+		free(container->data);
 		free(container);
 		container=NULL;
 	}
@@ -685,7 +1639,7 @@ Java_pl_droidsonroids_gif_GifDrawable_openStream(JNIEnv * env, jclass class,
 
 JNIEXPORT jlong JNICALL
 Java_pl_droidsonroids_gif_GifDrawable_openFd(JNIEnv * env, jclass class,
-		jintArray metaData, jobject jfd, jlong offset, jboolean justDecodeMetaData)
+		jintArray metaData, jobject jfd, jlong offset, jboolean justDecodeMetaData, jint sampleSize)
 {
 	jclass fdClass = (*env)->GetObjectClass(env, jfd);
 	jfieldID fdClassDescriptorFieldID = (*env)->GetFieldID(env, fdClass,
@@ -697,6 +1651,9 @@ Java_pl_droidsonroids_gif_GifDrawable_openFd(JNIEnv * env, jclass class,
 		return (jlong)(intptr_t) NULL;
 	}
 	jint fd = (*env)->GetIntField(env, jfd, fdClassDescriptorFieldID);
+	jlong mapped;
+	if (openMappedFile(fd, (long) offset, env, metaData, justDecodeMetaData, sampleSize, &mapped))
+		return mapped;
 	FILE* file = fdopen(dup(fd), "rb");
 	if (file == NULL || fseek(file, offset, SEEK_SET) != 0)
 	{
@@ -706,57 +1663,40 @@ Java_pl_droidsonroids_gif_GifDrawable_openFd(JNIEnv * env, jclass class,
 	}
 
 	int Error = 0;
+	TRACE_BEGIN(NULL, "header");
 	GifFileType* GifFileIn = DGifOpen(file, &fileRead, &Error);
+	TRACE_END(NULL, "header");
 	long startPos = ftell(file);
 
-	return (jlong)(intptr_t) open(GifFileIn, Error, startPos, fileRewind, env, metaData, justDecodeMetaData);
-}
-
-static void copyLine(argb* dst, const unsigned char* src,
-		const ColorMapObject* cmap, int transparent, int width)
-{
-	for (; width > 0; width--, src++, dst++)
-	{
-		if (*src != transparent)
-			getColorFromTable(*src, dst, cmap);
-	}
-}
-
-static argb*
-getAddr(argb* bm, int width, int left, int top)
-{
-	return bm + top * width + left;
+	return (jlong)(intptr_t) open(GifFileIn, Error, startPos, fileRewind, fileSeek, fileTell, env, metaData, justDecodeMetaData, sampleSize);
 }
 
-static void blitNormal(argb* bm, int width, int height, const SavedImage* frame,
-		const ColorMapObject* cmap, int transparent)
+#if !defined(DECODE_TO_CANVAS) || MAX_DECODE_THREADS > 0
+static void blitNormal(argb* bm, const GifInfo* info, const SavedImage* frame,
+		const argb* colorTable, int transparent)
 {
-	const unsigned char* src = frame->RasterBits;
-	argb* dst = getAddr(bm, width, frame->ImageDesc.Left, frame->ImageDesc.Top);
-	GifWord copyWidth = frame->ImageDesc.Width;
-	if (frame->ImageDesc.Left + copyWidth > width)
-	{
-		copyWidth = width - frame->ImageDesc.Left;
-	}
-
-	GifWord copyHeight = frame->ImageDesc.Height;
-	if (frame->ImageDesc.Top + copyHeight > height)
-	{
-		copyHeight = height - frame->ImageDesc.Top;
-	}
-
-	for (; copyHeight > 0; copyHeight--)
+	const GifImageDesc* desc = &frame->ImageDesc;
+	const int k = info->sampleSize;
+	GifWord left, top, right, bottom;
+	getCanvasRect(info, desc, &left, &top, &right, &bottom);
+	if (right <= left || bottom <= top)
+		return;
+	const unsigned char* src = frame->RasterBits
+			+ (top * k - desc->Top) * desc->Width + left * k - desc->Left;
+	argb* dst = getAddr(bm, info->width, left, top);
+	for (; top < bottom; top++)
 	{
-		copyLine(dst, src, cmap, transparent, copyWidth);
-		src += frame->ImageDesc.Width;
-		dst += width;
+		copyCanvasLine(info, dst, src, colorTable, transparent, right - left);
+		src += k * desc->Width;
+		dst += info->width;
 	}
 }
+#endif
 
 static void fillRect(argb* bm, int bmWidth, int bmHeight, GifWord left,
 		GifWord top, GifWord width, GifWord height, argb col)
 {
-	uint32_t* dst = (uint32_t*) getAddr(bm, bmWidth, left, top);
+	argb* dst = getAddr(bm, bmWidth, left, top);
 	GifWord copyWidth = width;
 	if (left + copyWidth > bmWidth)
 	{
@@ -768,18 +1708,16 @@ static void fillRect(argb* bm, int bmWidth, int bmHeight, GifWord left,
 	{
 		copyHeight = bmHeight - top;
 	}
-	uint32_t* pColor = (uint32_t*) (&col);
 	for (; copyHeight > 0; copyHeight--)
 	{
-		memset(dst, *pColor, copyWidth * sizeof(argb));
+		fillPixels(dst, col, copyWidth);
 		dst += bmWidth;
 	}
 }
 
-static void drawFrame(argb* bm, int bmWidth, int bmHeight,
-		const SavedImage* frame, const ColorMapObject* cmap, int transpIndex)
+static const ColorMapObject* getFrameColorMap(const SavedImage* frame,
+		const ColorMapObject* cmap)
 {
-
 	if (frame->ImageDesc.ColorMap != NULL)
 	{
 		// use local color table
@@ -787,9 +1725,17 @@ static void drawFrame(argb* bm, int bmWidth, int bmHeight,
 		if (cmap->ColorCount != (1 << cmap->BitsPerPixel))
 			cmap = defaultCmap;
 	}
+	return cmap;
+}
 
-	blitNormal(bm, bmWidth, bmHeight, frame, cmap, transpIndex);
+#if !defined(DECODE_TO_CANVAS) || MAX_DECODE_THREADS > 0
+static void drawFrame(argb* bm, const GifInfo* info,
+		const SavedImage* frame, const argb* colorTable, int transpIndex)
+{
+	TRACE_SCOPE(info, "blit");
+	blitNormal(bm, info, frame, colorTable, transpIndex);
 }
+#endif
 
 // return true if area of 'target' is completely covers area of 'covered'
 static bool checkIfCover(const SavedImage* target, const SavedImage* covered)
@@ -809,7 +1755,6 @@ static bool checkIfCover(const SavedImage* target, const SavedImage* covered)
 static inline void disposeFrameIfNeeded(argb* bm, GifInfo* info,
 		int idx)
 {
-	argb* backup = info->backupPtr;
 	argb color;
 	packARGB32(&color, 0, 0, 0, 0);
 	GifFileType* fGif = info->gifFilePtr;
@@ -819,73 +1764,978 @@ static inline void disposeFrameIfNeeded(argb* bm, GifInfo* info,
 	// and completely covers current area
     unsigned char curDisposal = info->infos[idx - 1].disposalMethod;
 	bool nextTrans = info->infos[idx].transpIndex != NO_TRANSPARENT_COLOR;
-    unsigned char nextDisposal = info->infos[idx].disposalMethod;
 	if (nextTrans || !checkIfCover(next, cur))
 	{
 		if (curDisposal == DISPOSE_BACKGROUND)
 		{// restore to background (under this image) color
-			fillRect(bm, fGif->SWidth, fGif->SHeight, cur->ImageDesc.Left,
-					cur->ImageDesc.Top, cur->ImageDesc.Width,
-					cur->ImageDesc.Height, color);
+			GifWord left, top, right, bottom;
+			getCanvasRect(info, &cur->ImageDesc, &left, &top, &right, &bottom);
+			fillRect(bm, info->width, info->height, left, top, right - left,
+					bottom - top, color);
         }
-		else if (curDisposal == DISPOSE_PREVIOUS && nextDisposal == DISPOSE_PREVIOUS)
-		{// restore to previous
-			argb* tmp = bm;
-			bm = backup;
-			backup = tmp;
+		else if (curDisposal == DISPOSE_PREVIOUS)
+		{// restore to previous, only area of this image has changed since backup
+			copyBackupRect(info, bm, idx - 1, true);
 	    }
 	}
+}
 
-	// Save current image if next frame's disposal method == DISPOSE_PREVIOUS
-	if (nextDisposal == DISPOSE_PREVIOUS)
-		memcpy(backup, bm, fGif->SWidth * fGif->SHeight * sizeof(argb));
+static void freeCheckpoints(GifInfo* info)
+{
+	int i;
+	for (i = 0; i < info->checkpointCount; i++)
+		free(info->checkpoints[i].pixels);
+	free(info->checkpoints);
+	info->checkpoints = NULL;
+	info->checkpointCount = 0;
+	info->checkpointInterval = 0;
 }
 
-static bool reset(GifInfo* info)
+/**
+ * Enables checkpoints every frameInterval frames, spaced further apart if all
+ * of them would not fit in maxBytes. Canvases are captured lazily as frames
+ * are rendered. Frames can be decoded out of order only if source can seek.
+ * @return false if checkpoints were disabled
+ */
+static bool setupCheckpoints(GifInfo* info, int frameInterval, size_t maxBytes)
 {
-	if (info->rewindFunction(info) != 0)
+	freeCheckpoints(info);
+	if (frameInterval < 1 || info->seekFunction == NULL)
 		return false;
-	info->nextStartTime = 0;
-	info->currentLoop = -1;
-	info->currentIndex = -1;
-	info->lastFrameReaminder = ULONG_MAX;
+	const int imgCount = info->gifFilePtr->ImageCount;
+	const size_t frameBytes = info->width * info->height * sizeof(argb);
+	const size_t maxCount = maxBytes / frameBytes;
+	if (maxCount < 1)
+		return false;
+	if ((size_t) (imgCount / frameInterval) >= maxCount)
+		frameInterval = (int) ((imgCount + maxCount - 1) / maxCount);
+	const int count = imgCount / frameInterval
+			+ (imgCount % frameInterval != 0 ? 1 : 0);
+	info->checkpoints = malloc(count * sizeof(Checkpoint));
+	if (info->checkpoints == NULL)
+		return false;
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		info->checkpoints[i].frameIndex = -1;
+		info->checkpoints[i].pixels = NULL;
+	}
+	info->checkpointCount = count;
+	info->checkpointInterval = frameInterval;
 	return true;
 }
 
-static void getBitmap(argb* bm, GifInfo* info)
+/**
+ * Stores canvas of current frame if its interval has no checkpoint yet.
+ * Frames disposed to previous are skipped since continuing from them needs
+ * backup canvas too.
+ */
+static void captureCheckpoint(GifInfo* info, const argb* bm)
 {
-	GifFileType* fGIF = info->gifFilePtr;
+	if (info->checkpoints == NULL)
+		return;
+	const int i = info->currentIndex;
+	Checkpoint* cp = &info->checkpoints[i / info->checkpointInterval];
+	if (cp->frameIndex >= 0 || info->infos[i].disposalMethod == DISPOSE_PREVIOUS)
+		return;
+	const size_t frameBytes = info->width * info->height * sizeof(argb);
+	if (cp->pixels == NULL)
+	{
+		cp->pixels = malloc(frameBytes);
+		if (cp->pixels == NULL)
+			return;
+	}
+	memcpy(cp->pixels, bm, frameBytes);
+	cp->frameIndex = i;
+}
+
+static void freeReplayCache(GifInfo* info)
+{
+	int i;
+	for (i = 0; i < info->replayFrameCount; i++)
+	{
+		free(info->replayFrames[i].pixels);
+		free(info->replayFrames[i].indices);
+	}
+	free(info->replayFrames);
+	info->replayFrames = NULL;
+	for (i = 0; i < info->replayPaletteCount; i++)
+		free(info->replayPalettes[i]);
+	free(info->replayPalettes);
+	info->replayPalettes = NULL;
+	info->replayPaletteCount = 0;
+	info->replayFrameCount = 0;
+	info->replayBytes = 0;
+	info->replayBudget = 0;
+}
+
+/**
+ * Enables keeping composited frames as they are rendered, up to maxBytes.
+ * Once all frames are kept they are replayed instead of being decoded.
+ */
+static bool setupReplayCache(GifInfo* info, size_t maxBytes)
+{
+	freeReplayCache(info);
+	if (maxBytes == 0)
+		return false;
+	info->replayFrames = calloc((size_t) info->gifFilePtr->ImageCount,
+			sizeof(ReplayFrame));
+	if (info->replayFrames == NULL)
+		return false;
+	info->replayBudget = maxBytes;
+	return true;
+}
+
+/**
+ * Computes area which may differ after frame idx is rendered over the previous
+ * one: rects of both frames, since disposal of the previous one (restoring
+ * included) cannot change anything outside its own rect. Whole canvas for the
+ * first frame. Rect is empty if right <= left or bottom <= top.
+ */
+static void getDirtyRect(const GifInfo* info, int idx, GifWord* left,
+		GifWord* top, GifWord* right, GifWord* bottom)
+{
+	const GifFileType* fGif = info->gifFilePtr;
+	*left = 0;
+	*top = 0;
+	*right = info->width;
+	*bottom = info->height;
+	if (idx <= 0)
+		return;
+	GifWord prevLeft, prevTop, prevRight, prevBottom;
+	getCanvasRect(info, &fGif->SavedImages[idx - 1].ImageDesc, &prevLeft,
+			&prevTop, &prevRight, &prevBottom);
+	getCanvasRect(info, &fGif->SavedImages[idx].ImageDesc, left, top, right,
+			bottom);
+	if (prevRight <= prevLeft || prevBottom <= prevTop)
+		return;
+	if (*right <= *left || *bottom <= *top)
+	{
+		*left = prevLeft;
+		*top = prevTop;
+		*right = prevRight;
+		*bottom = prevBottom;
+	}
+	else
+	{
+		*left = prevLeft < *left ? prevLeft : *left;
+		*top = prevTop < *top ? prevTop : *top;
+		*right = prevRight > *right ? prevRight : *right;
+		*bottom = prevBottom > *bottom ? prevBottom : *bottom;
+	}
+}
+
+static int getPaletteSlot(const ReplayPalette* pal, uint32_t color)
+{
+	int slot = (int) ((color * 2654435761U) >> 23);
+	while (pal->hashIndices[slot] >= 0 && pal->hashColors[slot] != color)
+		slot = (slot + 1) & 511;
+	return slot;
+}
+
+/**
+ * Drops colors appended to palette after first colorCount ones.
+ */
+static void truncatePalette(ReplayPalette* pal, int colorCount)
+{
+	int i;
+	memset(pal->hashIndices, 0xff, sizeof(pal->hashIndices));
+	for (i = 0; i < colorCount; i++)
+	{
+		uint32_t color;
+		memcpy(&color, &pal->colors[i], sizeof(color));
+		const int slot = getPaletteSlot(pal, color);
+		pal->hashColors[slot] = color;
+		pal->hashIndices[slot] = (int16_t) i;
+	}
+	pal->colorCount = colorCount;
+}
+
+/**
+ * Stores area of canvas as indices to palette, appending missing colors.
+ * @return false if palette would exceed 256 colors, it is left unchanged then
+ */
+static bool indexArea(ReplayPalette* pal, const argb* src, int stride,
+		GifWord width, GifWord height, uint8_t* dst)
+{
+	const int oldCount = pal->colorCount;
+	GifWord x, y;
+	for (y = 0; y < height; y++, src += stride)
+		for (x = 0; x < width; x++)
+		{
+			uint32_t color;
+			memcpy(&color, &src[x], sizeof(color));
+			const int slot = getPaletteSlot(pal, color);
+			if (pal->hashIndices[slot] < 0)
+			{
+				if (pal->colorCount == 256)
+				{
+					truncatePalette(pal, oldCount);
+					return false;
+				}
+				pal->colors[pal->colorCount] = src[x];
+				pal->hashColors[slot] = color;
+				pal->hashIndices[slot] = (int16_t) pal->colorCount++;
+			}
+			*dst++ = (uint8_t) pal->hashIndices[slot];
+		}
+	return true;
+}
+
+/**
+ * Keeps area of the frame as 8-bit indices, sharing last palette if its free
+ * entries are enough or starting a new one.
+ * @return false if area has more than 256 colors or memory is exhausted
+ */
+static bool keepIndexedArea(GifInfo* info, ReplayFrame* rf, const argb* src)
+{
+	const int stride = info->width;
+	const size_t indicesBytes = (size_t) rf->width * rf->height;
+	rf->indices = malloc(indicesBytes);
+	if (rf->indices == NULL)
+		return false;
+	if (info->replayPaletteCount > 0)
+	{
+		ReplayPalette* pal = info->replayPalettes[info->replayPaletteCount - 1];
+		if (indexArea(pal, src, stride, rf->width, rf->height, rf->indices))
+		{
+			rf->palette = pal;
+			info->replayBytes += indicesBytes;
+			return true;
+		}
+	}
+	ReplayPalette** tmpPalettes = realloc(info->replayPalettes,
+			(info->replayPaletteCount + 1) * sizeof(ReplayPalette*));
+	ReplayPalette* pal = malloc(sizeof(ReplayPalette));
+	if (tmpPalettes != NULL)
+		info->replayPalettes = tmpPalettes;
+	if (tmpPalettes == NULL || pal == NULL)
+	{
+		free(pal);
+		free(rf->indices);
+		rf->indices = NULL;
+		return false;
+	}
+	truncatePalette(pal, 0);
+	if (!indexArea(pal, src, stride, rf->width, rf->height, rf->indices))
+	{
+		free(pal);
+		free(rf->indices);
+		rf->indices = NULL;
+		return false;
+	}
+	info->replayPalettes[info->replayPaletteCount++] = pal;
+	rf->palette = pal;
+	info->replayBytes += indicesBytes + sizeof(ReplayPalette);
+	return true;
+}
+
+/**
+ * Keeps current frame if all previous ones are already kept, only within its
+ * dirty rect. Cache is dropped if it does not fit in budget.
+ */
+static void captureReplayFrame(GifInfo* info, const argb* bm)
+{
+	const int idx = info->currentIndex;
+	if (info->replayFrames == NULL || idx != info->replayFrameCount)
+		return;
+	GifWord left, top, right, bottom;
+	getDirtyRect(info, idx, &left, &top, &right, &bottom);
+	ReplayFrame* rf = &info->replayFrames[idx];
+	rf->left = left;
+	rf->top = top;
+	//subsampled rects may be empty in one dimension only
+	rf->width = right > left && bottom > top ? right - left : 0;
+	rf->height = rf->width > 0 ? bottom - top : 0;
+	const argb* src = bm + top * info->width + left;
+	if (rf->width > 0 && keepIndexedArea(info, rf, src))
+	{
+		info->replayFrameCount++;
+		if (info->replayBytes > info->replayBudget)
+			freeReplayCache(info);
+		return;
+	}
+	//more than 256 colors, kept as they are
+	const size_t frameBytes = (size_t) rf->width * rf->height * sizeof(argb);
+	if (info->replayBytes + frameBytes > info->replayBudget)
+	{
+		freeReplayCache(info);
+		return;
+	}
+	if (frameBytes > 0)
+	{
+		rf->pixels = malloc(frameBytes);
+		if (rf->pixels == NULL)
+		{
+			freeReplayCache(info);
+			return;
+		}
+		GifWord y;
+		for (y = 0; y < rf->height; y++)
+			memcpy(rf->pixels + y * rf->width, src + y * info->width,
+					rf->width * sizeof(argb));
+	}
+	info->replayBytes += frameBytes;
+	info->replayFrameCount++;
+}
+
+/**
+ * Draws current frame from replay cache, canvas must hold previous frame.
+ * @return false if not all frames are kept yet
+ */
+static bool replayFrame(GifInfo* info, argb* bm)
+{
+	const GifFileType* fGif = info->gifFilePtr;
+	if (info->replayFrames == NULL || info->replayFrameCount < fGif->ImageCount)
+		return false;
+	const int idx = info->currentIndex;
+	const ReplayFrame* rf = &info->replayFrames[idx];
+	argb* dst = bm + rf->top * info->width + rf->left;
+	GifWord x, y;
+	if (rf->indices != NULL)
+	{
+		const uint8_t* src = rf->indices;
+		const argb* colors = rf->palette->colors;
+		for (y = 0; y < rf->height; y++, dst += info->width)
+			for (x = 0; x < rf->width; x++)
+				dst[x] = colors[*src++];
+	}
+	else
+		for (y = 0; y < rf->height; y++, dst += info->width)
+			memcpy(dst, rf->pixels + y * rf->width, rf->width * sizeof(argb));
+	if (idx >= fGif->ImageCount - 1 && info->loopCount > 0)
+		info->currentLoop++;
+	return true;
+}
+
+/**
+ * Restarts animation. Inputs which can seek are not rewound since the first
+ * frame is decoded from its own LZW data, so streams are not reset either.
+ */
+static bool reset(GifInfo* info)
+{
+	if (info->seekFunction == NULL && rewindInput(info) != 0)
+		return false;
+	info->nextStartTime = 0;
+	info->currentLoop = -1;
+	info->currentIndex = -1;
+	info->lastFrameReaminder = ULONG_MAX;
+	return true;
+}
+
+/**
+ * Erases canvas before first frame or disposes previous one otherwise.
+ */
+static void prepareCanvas(argb* bm, GifInfo* info, int idx)
+{
+	TRACE_SCOPE(info, "dispose");
+	GifFileType* fGIF = info->gifFilePtr;
+	if (idx == 0)
+	{
+	    argb paintingColor;
+		if (info->infos[idx].transpIndex == -1)
+			getColorFromTable(fGIF->SBackGroundColor, &paintingColor,
+					fGIF->SColorMap);
+		else
+			packARGB32(&paintingColor, 0, 0, 0, 0);
+		eraseColor(bm, info->width, info->height, paintingColor);
+	}
+	else
+	{
+		// Dispose previous frame before move to next frame.
+		disposeFrameIfNeeded(bm, info, idx);
+	}
+	// Save area under frame if its disposal method == DISPOSE_PREVIOUS
+	if (info->infos[idx].disposalMethod == DISPOSE_PREVIOUS)
+		copyBackupRect(info, bm, idx, false);
+}
+
+static void getBitmap(argb* bm, GifInfo* info)
+{
+	GifFileType* fGIF = info->gifFilePtr;
     if (fGIF->Error == D_GIF_ERR_REWIND_FAILED)
         return;
 
-	int i = info->currentIndex;
+	int i = info->currentIndex;
+	if (replayFrame(info, bm))
+		return;
+#if MAX_DECODE_THREADS > 0
+	if (drawDecodedAhead(info, bm))
+		return;
+#endif
+
+#ifndef DECODE_TO_CANVAS
+	if (DDGifSlurp(fGIF, info, true, bm) == GIF_ERROR)
+	{
+	    if (!reset(info))
+	        fGIF->Error = D_GIF_ERR_REWIND_FAILED;
+		return;
+    }
+#endif
+
+	prepareCanvas(bm, info, i);
+#ifdef DECODE_TO_CANVAS
+	// Frame is drawn while being decoded
+	if (DDGifSlurp(fGIF, info, true, bm) == GIF_ERROR)
+	{
+	    if (!reset(info))
+	        fGIF->Error = D_GIF_ERR_REWIND_FAILED;
+	}
+#else
+	drawFrame(bm, info, &fGIF->SavedImages[i],
+			info->infos[i].colorTable, info->infos[i].transpIndex);
+#endif
+	if (info->currentIndex == i)
+	{
+		captureCheckpoint(info, bm);
+		captureReplayFrame(info, bm);
+#if MAX_DECODE_THREADS > 0
+		requestDecodeAhead(info);
+#endif
+	}
+}
+
+#if MAX_DECODE_THREADS > 0
+/**
+ * Decodes index raster of given frame using separate reader of the same data.
+ * @return 0 on success, error code otherwise
+ */
+static int decodeRasterAt(GifFileType* GifFile, const GifInfo* info, int idx,
+		GifByteType* raster)
+{
+	TRACE_SCOPE(info, "decode");
+	const SavedImage* frame = &info->gifFilePtr->SavedImages[idx];
+	if (checkFrameDims(GifFile, frame) == GIF_ERROR)
+		return GifFile->Error;
+	if (DGifSeekMem(GifFile, info->infos[idx].dataPos) == GIF_ERROR)
+		return D_GIF_ERR_READ_FAILED;
+	if (DGifStartImage(GifFile, &frame->ImageDesc) == GIF_ERROR
+			|| decodeRaster(GifFile, &frame->ImageDesc, raster) == GIF_ERROR)
+		return GifFile->Error;
+	return 0;
+}
+
+static void* parallelDecodeWorker(void* arg)
+{
+	ParallelDecoder* pd = arg;
+	int Error = 0;
+	//each worker needs its own decoder state and input position
+	GifFileType* GifFile = DGifOpenMem(NULL, pd->data, pd->dataSize, &Error);
+
+	pthread_mutex_lock(&pd->mutex);
+	for (;;)
+	{
+		//slot of the next frame is free once the frame decoded there before is composited
+		while (pd->nextIdx <= pd->lastIdx && pd->nextIdx < pd->failedIdx
+				&& pd->nextIdx - pd->composedIdx > pd->slotCount)
+			pthread_cond_wait(&pd->cond, &pd->mutex);
+		if (pd->nextIdx > pd->lastIdx || pd->nextIdx >= pd->failedIdx)
+			break;
+		const int idx = pd->nextIdx++;
+		pthread_mutex_unlock(&pd->mutex);
+
+		const int slot = idx % pd->slotCount;
+		if (GifFile != NULL)
+			Error = decodeRasterAt(GifFile, pd->info, idx, pd->slots[slot]);
+
+		pthread_mutex_lock(&pd->mutex);
+		if (Error == 0)
+			pd->slotFrames[slot] = idx;
+		else if (idx < pd->failedIdx)
+		{
+			pd->failedIdx = idx;
+			pd->failedError = Error;
+		}
+		pthread_cond_broadcast(&pd->cond);
+	}
+	if (GifFile != NULL)
+	{
+		unsigned long bytesRead, codeCount;
+		DGifGetCounters(GifFile, &bytesRead, &codeCount);
+		pd->bytesRead += bytesRead;
+		pd->codeCount += codeCount;
+		pd->bufferBytes += DGifGetBufferSize(GifFile);
+	}
+	pthread_mutex_unlock(&pd->mutex);
+	if (GifFile != NULL)
+		DGifCloseFile(GifFile);
+	return NULL;
+}
+
+static void composeDecodedFrame(GifInfo* info, argb* bm, int idx,
+		GifByteType* raster)
+{
+	GifFileType* fGIF = info->gifFilePtr;
+	info->currentIndex = idx;
+	prepareCanvas(bm, info, idx);
+	SavedImage frame = fGIF->SavedImages[idx];
+	frame.RasterBits = raster;
+	drawFrame(bm, info, &frame,
+			info->infos[idx].colorTable, info->infos[idx].transpIndex);
+	if (idx >= fGIF->ImageCount - 1 && info->loopCount > 0)
+		info->currentLoop++;
+	captureCheckpoint(info, bm);
+	captureReplayFrame(info, bm);
+}
+
+static DecodeScheduler scheduler =
+{ PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+		PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0 };
+
+static bool isJobBefore(const DecodeAhead* a, const DecodeAhead* b)
+{
+	if (a->priority != b->priority)
+		return a->priority < b->priority;
+	return a->deadline < b->deadline;
+}
+
+static void placeJob(DecodeAhead* da, int pos)
+{
+	scheduler.queue[pos] = da;
+	da->queuePos = pos;
+}
+
+static void siftJob(int pos)
+{
+	DecodeAhead** queue = scheduler.queue;
+	DecodeAhead* da = queue[pos];
+	while (pos > 0 && isJobBefore(da, queue[(pos - 1) / 2]))
+	{
+		placeJob(queue[(pos - 1) / 2], pos);
+		pos = (pos - 1) / 2;
+	}
+	for (;;)
+	{
+		int child = 2 * pos + 1;
+		if (child >= scheduler.queueSize)
+			break;
+		if (child + 1 < scheduler.queueSize
+				&& isJobBefore(queue[child + 1], queue[child]))
+			child++;
+		if (!isJobBefore(queue[child], da))
+			break;
+		placeJob(queue[child], pos);
+		pos = child;
+	}
+	placeJob(da, pos);
+}
+
+/**
+ * Queues job or updates its position after deadline or priority change.
+ * Must be called with scheduler mutex held.
+ */
+static bool queueJob(DecodeAhead* da)
+{
+	if (da->queuePos < 0)
+	{
+		if (scheduler.queueSize == scheduler.queueCapacity)
+		{
+			const int capacity = scheduler.queueCapacity * 2 + 8;
+			DecodeAhead** queue = realloc(scheduler.queue,
+					capacity * sizeof(DecodeAhead*));
+			if (queue == NULL)
+				return false;
+			scheduler.queue = queue;
+			scheduler.queueCapacity = capacity;
+		}
+		placeJob(da, scheduler.queueSize++);
+	}
+	siftJob(da->queuePos);
+	pthread_cond_signal(&scheduler.workCond);
+	return true;
+}
+
+/**
+ * Removes job from queue if it is there. Must be called with scheduler mutex held.
+ */
+static void unqueueJob(DecodeAhead* da)
+{
+	const int pos = da->queuePos;
+	if (pos < 0)
+		return;
+	da->queuePos = -1;
+	DecodeAhead* last = scheduler.queue[--scheduler.queueSize];
+	if (last != da)
+	{
+		placeJob(last, pos);
+		siftJob(pos);
+	}
+}
+
+/**
+ * Queues decoding of requested frame unless it is already decoded, being
+ * decoded or instance is paused. Must be called with scheduler mutex held.
+ */
+static void scheduleJob(DecodeAhead* da)
+{
+	const int idx = da->requestedIdx;
+	if (idx < 0 || idx == da->readyIdx || idx == da->failedIdx
+			|| da->priority == DECODE_PRIORITY_PAUSED)
+		unqueueJob(da);
+	else if (!da->busy) //busy jobs are rescheduled by pool thread when finished
+		queueJob(da);
+}
+
+static void* schedulerWorker(void* arg)
+{
+	pthread_mutex_lock(&scheduler.mutex);
+	for (;;)
+	{
+		while (scheduler.queueSize == 0)
+			pthread_cond_wait(&scheduler.workCond, &scheduler.mutex);
+		DecodeAhead* da = scheduler.queue[0];
+		unqueueJob(da);
+		const int idx = da->requestedIdx;
+		//raster is not read by calling thread until requested frame is ready
+		da->busy = true;
+		da->readyIdx = -1;
+		da->failedIdx = -1;
+		pthread_mutex_unlock(&scheduler.mutex);
+
+		const int Error = decodeRasterAt(da->reader, da->info, idx, da->raster);
+
+		pthread_mutex_lock(&scheduler.mutex);
+		DGifGetCounters(da->reader, &da->bytesRead, &da->codeCount);
+		da->bufferBytes = DGifGetBufferSize(da->reader);
+		da->busy = false;
+		if (Error == 0)
+			da->readyIdx = idx;
+		else
+			da->failedIdx = idx;
+		scheduleJob(da);
+		pthread_cond_broadcast(&scheduler.doneCond);
+	}
+	return NULL;
+}
+
+/**
+ * Lazily starts pool threads, they live as long as the process.
+ * Must be called with scheduler mutex held.
+ */
+static bool startScheduler(void)
+{
+	if (scheduler.threadCount > 0)
+		return true;
+	long threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threadCount > MAX_DECODE_THREADS)
+		threadCount = MAX_DECODE_THREADS;
+	pthread_attr_t attr;
+	if (pthread_attr_init(&attr) != 0)
+		return false;
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	do
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, &attr, schedulerWorker, NULL) != 0)
+			break;
+		scheduler.threadCount++;
+	}
+	while (scheduler.threadCount < threadCount);
+	pthread_attr_destroy(&attr);
+	return scheduler.threadCount > 0;
+}
+
+static void requestDecodeAhead(GifInfo* info)
+{
+	DecodeAhead* da = info->decodeAhead;
+	if (da == NULL || info->currentIndex < 0)
+		return;
+	__time_t duration = info->infos[info->currentIndex].duration;
+	if (info->speedFactor != 1.0)
+		duration /= info->speedFactor;
+	pthread_mutex_lock(&scheduler.mutex);
+	da->requestedIdx = (info->currentIndex + 1) % info->gifFilePtr->ImageCount;
+	da->deadline = getRealTime() + duration;
+	scheduleJob(da);
+	pthread_mutex_unlock(&scheduler.mutex);
+}
+
+static bool drawDecodedAhead(GifInfo* info, argb* bm)
+{
+	DecodeAhead* da = info->decodeAhead;
+	const int idx = info->currentIndex;
+	if (da == NULL)
+		return false;
+	pthread_mutex_lock(&scheduler.mutex);
+	//frames other than requested one (e.g. after seeking) are decoded on calling thread
+	const bool requested = da->requestedIdx == idx;
+	da->keptUp = requested && da->readyIdx == idx;
+	while (requested && da->busy)
+		pthread_cond_wait(&scheduler.doneCond, &scheduler.mutex);
+	const bool ready = requested && da->readyIdx == idx;
+	//frame not picked up by pool yet is decoded on calling thread instead of waiting
+	if (!ready)
+		unqueueJob(da);
+	pthread_mutex_unlock(&scheduler.mutex);
+	if (!ready)
+		return false;
+	composeDecodedFrame(info, bm, idx, da->raster);
+	requestDecodeAhead(info);
+	return true;
+}
+
+/**
+ * Changes priority of instance decoding ahead, paused ones are not decoded.
+ */
+static void setDecodePriority(GifInfo* info, int priority)
+{
+	DecodeAhead* da = info->decodeAhead;
+	if (da == NULL)
+		return;
+	pthread_mutex_lock(&scheduler.mutex);
+	da->priority = priority;
+	scheduleJob(da);
+	pthread_mutex_unlock(&scheduler.mutex);
+}
+
+/**
+ * Adds input consumed so far by background reader to given stats.
+ */
+static void addDecodeAheadCounters(GifInfo* info, RenderStats* stats)
+{
+	DecodeAhead* da = info->decodeAhead;
+	if (da == NULL)
+		return;
+	pthread_mutex_lock(&scheduler.mutex);
+	stats->bytesRead += da->bytesRead;
+	stats->codesDecoded += da->codeCount;
+	pthread_mutex_unlock(&scheduler.mutex);
+}
+
+static bool isDecodedAhead(GifInfo* info)
+{
+	DecodeAhead* da = info->decodeAhead;
+	if (da == NULL)
+		return false;
+	pthread_mutex_lock(&scheduler.mutex);
+	const bool ready = da->requestedIdx >= 0 && da->readyIdx == da->requestedIdx;
+	pthread_mutex_unlock(&scheduler.mutex);
+	return ready;
+}
+
+static void stopDecodeAhead(GifInfo* info)
+{
+	DecodeAhead* da = info->decodeAhead;
+	if (da == NULL)
+		return;
+	pthread_mutex_lock(&scheduler.mutex);
+	unqueueJob(da);
+	while (da->busy)
+		pthread_cond_wait(&scheduler.doneCond, &scheduler.mutex);
+	pthread_mutex_unlock(&scheduler.mutex);
+	unsigned long bytesRead, codeCount;
+	DGifGetCounters(da->reader, &bytesRead, &codeCount);
+	info->stats.bytesRead += bytesRead;
+	info->stats.codesDecoded += codeCount;
+	DGifCloseFile(da->reader);
+	free(da->raster);
+	free(da);
+	info->decodeAhead = NULL;
+}
+
+/**
+ * Registers instance in shared scheduler decoding frame following current
+ * one, possible only if input is in memory and frames can be sought.
+ */
+static bool startDecodeAhead(GifInfo* info)
+{
+	GifFileType* fGIF = info->gifFilePtr;
+	unsigned long dataSize;
+	const GifByteType* data = DGifGetMem(fGIF, &dataSize);
+	if (info->decodeAhead != NULL)
+		return true;
+	if (data == NULL || info->seekFunction == NULL || info->rasterBits == NULL
+			|| fGIF->ImageCount < 2)
+		return false;
+	pthread_mutex_lock(&scheduler.mutex);
+	const bool started = startScheduler();
+	pthread_mutex_unlock(&scheduler.mutex);
+	if (!started)
+		return false;
+	DecodeAhead* da = calloc(1, sizeof(DecodeAhead));
+	if (da == NULL)
+		return false;
+	int Error = 0;
+	da->info = info;
+	da->reader = DGifOpenMem(NULL, data, dataSize, &Error);
+	da->raster = malloc((size_t) fGIF->SWidth * fGIF->SHeight);
+	da->requestedIdx = da->readyIdx = da->failedIdx = -1;
+	da->priority = DECODE_PRIORITY_VISIBLE;
+	da->queuePos = -1;
+	if (da->reader == NULL || da->raster == NULL)
+	{
+		if (da->reader != NULL)
+			DGifCloseFile(da->reader);
+		free(da->raster);
+		free(da);
+		return false;
+	}
+	info->decodeAhead = da;
+	requestDecodeAhead(info);
+	return true;
+}
+
+/**
+ * Renders frames following current one up to lastIdx. Index rasters are
+ * decoded by worker threads, each reading input on its own, while calling
+ * thread composites them in order.
+ * @return false if frames cannot be decoded in parallel, nothing is rendered then
+ */
+static bool renderFramesParallel(GifInfo* info, argb* bm, int lastIdx)
+{
+	GifFileType* fGIF = info->gifFilePtr;
+	ParallelDecoder pd;
+	pd.data = DGifGetMem(fGIF, &pd.dataSize);
+	const int firstIdx = info->currentIndex + 1;
+	if (pd.data == NULL || info->seekFunction == NULL || lastIdx <= firstIdx)
+		return false;
+
+	long threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threadCount > MAX_DECODE_THREADS)
+		threadCount = MAX_DECODE_THREADS;
+	if (threadCount > lastIdx - firstIdx + 1)
+		threadCount = lastIdx - firstIdx + 1;
+	if (threadCount < 2)
+		return false;
+
+	pd.info = info;
+	pd.nextIdx = firstIdx;
+	pd.lastIdx = lastIdx;
+	pd.composedIdx = firstIdx - 1;
+	pd.failedIdx = INT_MAX;
+	pd.failedError = 0;
+	pd.bytesRead = 0;
+	pd.codeCount = 0;
+	pd.bufferBytes = 0;
+	pd.slotCount = (int) threadCount * 2;
+	pd.slots = calloc((size_t) pd.slotCount, sizeof(GifByteType*));
+	pd.slotFrames = malloc(pd.slotCount * sizeof(int));
+	bool ok = pd.slots != NULL && pd.slotFrames != NULL;
+	int i;
+	for (i = 0; ok && i < pd.slotCount; i++)
+	{
+		pd.slotFrames[i] = -1;
+		pd.slots[i] = malloc((size_t) (fGIF->SWidth * fGIF->SHeight));
+		ok = pd.slots[i] != NULL;
+	}
+
+	pthread_t threads[MAX_DECODE_THREADS];
+	int started = 0;
+	if (ok && pthread_mutex_init(&pd.mutex, NULL) == 0)
+	{
+		if (pthread_cond_init(&pd.cond, NULL) == 0)
+		{
+			for (; started < threadCount; started++)
+				if (pthread_create(&threads[started], NULL,
+						parallelDecodeWorker, &pd) != 0)
+					break;
+			if (started > 0)
+			{
+				int idx;
+				for (idx = firstIdx; idx <= lastIdx; idx++)
+				{
+					const int slot = idx % pd.slotCount;
+					pthread_mutex_lock(&pd.mutex);
+					while (pd.slotFrames[slot] != idx && pd.failedIdx > idx)
+						pthread_cond_wait(&pd.cond, &pd.mutex);
+					const int Error = pd.slotFrames[slot] == idx ? 0 : pd.failedError;
+					pthread_mutex_unlock(&pd.mutex);
+					if (Error != 0)
+					{
+						fGIF->Error = Error;
+						if (!reset(info))
+							fGIF->Error = D_GIF_ERR_REWIND_FAILED;
+						break;
+					}
+					composeDecodedFrame(info, bm, idx, pd.slots[slot]);
+					pthread_mutex_lock(&pd.mutex);
+					pd.composedIdx = idx;
+					pthread_cond_broadcast(&pd.cond);
+					pthread_mutex_unlock(&pd.mutex);
+				}
+				pthread_mutex_lock(&pd.mutex);
+				pd.nextIdx = lastIdx + 1;
+				pthread_cond_broadcast(&pd.cond);
+				pthread_mutex_unlock(&pd.mutex);
+				for (i = 0; i < started; i++)
+					pthread_join(threads[i], NULL);
+				info->stats.bytesRead += pd.bytesRead;
+				info->stats.codesDecoded += pd.codeCount;
+				const size_t parallelBytes = pd.bufferBytes + (size_t) pd.slotCount
+						* fGIF->SWidth * fGIF->SHeight;
+				if (info->parallelBytes < parallelBytes)
+					info->parallelBytes = parallelBytes;
+			}
+			pthread_cond_destroy(&pd.cond);
+		}
+		pthread_mutex_destroy(&pd.mutex);
+	}
+
+	for (i = 0; pd.slots != NULL && i < pd.slotCount; i++)
+		free(pd.slots[i]);
+	free(pd.slots);
+	free(pd.slotFrames);
+	return started > 0;
+}
+#endif
 
-	if (DDGifSlurp(fGIF, info, true) == GIF_ERROR)
+/**
+ * Renders frames up to desiredIdx, starting from the nearest checkpoint
+ * before it if current frame is further away or already past it.
+ */
+static void seekCanvas(GifInfo* info, argb* bm, int desiredIdx)
+{
+	if (info->checkpoints != NULL)
 	{
-	    if (!reset(info))
-	        fGIF->Error = D_GIF_ERR_REWIND_FAILED;
+		int j = desiredIdx / info->checkpointInterval;
+		for (; j >= 0; j--)
+		{
+			const Checkpoint* cp = &info->checkpoints[j];
+			if (cp->frameIndex < 0 || cp->frameIndex > desiredIdx)
+				continue;
+			if (cp->frameIndex > info->currentIndex
+					|| info->currentIndex > desiredIdx)
+			{
+				memcpy(bm, cp->pixels, info->width * info->height
+						* sizeof(argb));
+				info->currentIndex = cp->frameIndex;
+			}
+			break;
+		}
+		//frames are decoded by seeking to their data so no rewind is needed
+		if (info->currentIndex > desiredIdx)
+			info->currentIndex = -1;
+	}
+#if MAX_DECODE_THREADS > 0
+	if (renderFramesParallel(info, bm, desiredIdx))
 		return;
-    }
-
-	SavedImage* cur = &fGIF->SavedImages[i];
-	int transpIndex = info->infos[i].transpIndex;
-	if (i == 0)
+#endif
+	while (info->currentIndex < desiredIdx)
 	{
-	    argb paintingColor;
-		if (transpIndex == -1)
-			getColorFromTable(fGIF->SBackGroundColor, &paintingColor,
-					fGIF->SColorMap);
-		else
-			packARGB32(&paintingColor, 0, 0, 0, 0);
-		eraseColor(bm, fGIF->SWidth, fGIF->SHeight, paintingColor);
+		const int nextIdx = info->currentIndex + 1;
+		info->currentIndex = nextIdx;
+		getBitmap(bm, info);
+		if (info->currentIndex != nextIdx)
+			break;
 	}
-	else
+}
+
+/**
+ * Returns index of the frame shown at given time since the beginning of the
+ * loop, last frame if time exceeds loop duration.
+ */
+static int getFrameIndexAtTime(const GifInfo* info, unsigned long time)
+{
+	int low = 0, high = info->gifFilePtr->ImageCount - 1;
+	while (low < high)
 	{
-		// Dispose previous frame before move to next frame.
-		disposeFrameIfNeeded(bm, info, i);
+		const int mid = (low + high) / 2;
+		if (info->frameStartTimes[mid + 1] >= time)
+			high = mid;
+		else
+			low = mid + 1;
 	}
-	drawFrame(bm, fGIF->SWidth, fGIF->SHeight, cur, fGIF->SColorMap,
-			transpIndex);
+	return low;
 }
 
 JNIEXPORT void JNICALL
@@ -898,6 +2748,22 @@ Java_pl_droidsonroids_gif_GifDrawable_reset(JNIEnv * env, jclass class,
 	reset(info);
 }
 
+void setGifFramePolicy(GifInfo* info, int policy)
+{
+	if (policy >= FRAME_POLICY_DELAY && policy <= FRAME_POLICY_CATCH_UP)
+		info->framePolicy = policy;
+}
+
+JNIEXPORT void JNICALL
+Java_pl_droidsonroids_gif_GifDrawable_setFramePolicy(JNIEnv * env, jclass class,
+		jlong gifInfo, jint policy)
+{
+	GifInfo* info =(GifInfo*)(intptr_t) gifInfo;
+	if (info == NULL)
+		return;
+	setGifFramePolicy(info, policy);
+}
+
 JNIEXPORT void JNICALL
 Java_pl_droidsonroids_gif_GifDrawable_setSpeedFactor(JNIEnv * env, jclass class,
 		jlong gifInfo, jfloat factor)
@@ -908,43 +2774,47 @@ Java_pl_droidsonroids_gif_GifDrawable_setSpeedFactor(JNIEnv * env, jclass class,
 	info->speedFactor = factor;
 }
 
+/**
+ * Returns pixels of given array or registered frame buffer if array is NULL.
+ */
+static argb* lockPixels(JNIEnv * env, GifInfo* info, jintArray jPixels)
+{
+	if (jPixels == NULL)
+		return info->frameBufferPixels;
+	return (argb *) (*env)->GetIntArrayElements(env, jPixels, 0);
+}
+
+static void unlockPixels(JNIEnv * env, jintArray jPixels, argb* pixels)
+{
+	if (jPixels != NULL)
+		(*env)->ReleaseIntArrayElements(env, jPixels, (jint *) pixels, 0);
+}
+
 JNIEXPORT void JNICALL
 Java_pl_droidsonroids_gif_GifDrawable_seekToTime(JNIEnv * env, jclass class,
 		jlong gifInfo, jint desiredPos, jintArray jPixels)
 {
 	GifInfo* info =(GifInfo*)(intptr_t) gifInfo;
-	if (info == NULL ||jPixels==NULL)
+	if (info == NULL || (jPixels == NULL && info->frameBufferPixels == NULL))
 		return;
 	int imgCount = info->gifFilePtr->ImageCount;
 	if (imgCount <= 1)
 		return;
 
-	unsigned long sum = 0;
-	int i;
-	for (i = 0; i < imgCount; i++)
-	{
-		unsigned long newSum = sum + info->infos[i].duration;
-		if (newSum >= desiredPos)
-			break;
-		sum = newSum;
-	}
-	if (i < info->currentIndex)
+	const int i = getFrameIndexAtTime(info, (unsigned long) desiredPos);
+	if (i < info->currentIndex && info->checkpoints == NULL)
 		return;
 
-	unsigned long lastFrameRemainder = desiredPos - sum;
+	unsigned long lastFrameRemainder = desiredPos - info->frameStartTimes[i];
 	if (i == imgCount - 1 && lastFrameRemainder > info->infos[i].duration)
 		lastFrameRemainder = info->infos[i].duration;
-	if (i > info->currentIndex)
+	if (i != info->currentIndex)
 	{
-		jint* const pixels = (*env)->GetIntArrayElements(env, jPixels, 0);
+		argb* const pixels = lockPixels(env, info, jPixels);
 		if (pixels==NULL)
 		    return;
-		while (info->currentIndex <= i)
-		{
-			info->currentIndex++;
-            getBitmap((argb *) pixels, info);
-		}
-		(*env)->ReleaseIntArrayElements(env, jPixels, pixels, 0);
+		seekCanvas(info, pixels, i);
+		unlockPixels(env, jPixels, pixels);
 	}
 	info->lastFrameReaminder = lastFrameRemainder;
 
@@ -960,16 +2830,17 @@ Java_pl_droidsonroids_gif_GifDrawable_seekToFrame(JNIEnv * env, jclass class,
 		jlong gifInfo, jint desiredIdx, jintArray jPixels)
 {
 	GifInfo* info =(GifInfo*)(intptr_t) gifInfo;
-	if (info == NULL|| jPixels==NULL)
+	if (info == NULL || (jPixels == NULL && info->frameBufferPixels == NULL))
 		return;
-	if (desiredIdx <= info->currentIndex)
+	if (desiredIdx == info->currentIndex
+			|| (desiredIdx < info->currentIndex && info->checkpoints == NULL))
 		return;
 
 	int imgCount = info->gifFilePtr->ImageCount;
 	if (imgCount <= 1)
 		return;
 
-	jint * const pixels = (*env)->GetIntArrayElements(env, jPixels, 0);
+	argb* const pixels = lockPixels(env, info, jPixels);
 	if (pixels==NULL)
 	    return;
 
@@ -977,82 +2848,297 @@ Java_pl_droidsonroids_gif_GifDrawable_seekToFrame(JNIEnv * env, jclass class,
 	if (desiredIdx >= imgCount)
 		desiredIdx = imgCount - 1;
 
-	while (info->currentIndex < desiredIdx)
-	{
-		info->currentIndex++;
-        getBitmap((argb *) pixels, info);
-	}
-	(*env)->ReleaseIntArrayElements(env, jPixels, pixels, 0);
+	seekCanvas(info, pixels, desiredIdx);
+	unlockPixels(env, jPixels, pixels);
+	//currentIndex is reset to -1 if seeking failed
+	const int idx = info->currentIndex >= 0 ? info->currentIndex : desiredIdx;
 	if (info->speedFactor == 1.0)
 		info->nextStartTime = getRealTime()
-				+ info->infos[info->currentIndex].duration;
+				+ info->infos[idx].duration;
 	else
 		info->nextStartTime = getRealTime()
-                + (unsigned long) (info->infos[info->currentIndex].duration * info->speedFactor);
+                + (unsigned long) (info->infos[idx].duration * info->speedFactor);
 
 }
 
-JNIEXPORT jboolean JNICALL
-Java_pl_droidsonroids_gif_GifDrawable_renderFrame(JNIEnv * env, jclass class,
-		jintArray jPixels, jlong gifInfo, jintArray metaData)
+/**
+ * Moves to the next frame if it is due. Returns true if it has to be drawn.
+ */
+static bool advanceFrame(GifInfo* info, __time_t rt)
 {
-	GifInfo* info =(GifInfo*)(intptr_t) gifInfo;
-	if (info == NULL || jPixels==NULL)
-		return JNI_FALSE;
-	bool needRedraw = false;
-	__time_t rt = getRealTime();
-	jboolean isAnimationCompleted;
-	if (rt >= info->nextStartTime && info->currentLoop < info->loopCount)
+	if (rt < info->nextStartTime || info->currentLoop >= info->loopCount)
+		return false;
+	if (++info->currentIndex >= info->gifFilePtr->ImageCount)
+		info->currentIndex = 0;
+	return true;
+}
+
+static unsigned int getScaledDuration(const GifInfo* info, int idx)
+{
+	unsigned int scaledDuration = info->infos[idx].duration;
+	if (info->speedFactor != 1.0)
 	{
-		if (++info->currentIndex >= info->gifFilePtr->ImageCount)
-			info->currentIndex = 0;
-		needRedraw = true;
-		isAnimationCompleted = info->currentIndex >= info->gifFilePtr->ImageCount -1 ?
-		    JNI_TRUE : JNI_FALSE;
+		scaledDuration /= info->speedFactor;
+		if (scaledDuration<=0)
+		    scaledDuration=1;
+		else if (scaledDuration>INT_MAX)
+		    scaledDuration=INT_MAX;
 	}
-	else
-	    isAnimationCompleted=JNI_FALSE;
+	return scaledDuration;
+}
 
-	jint* const rawMetaData = (*env)->GetIntArrayElements(env, metaData, 0);
-	if (rawMetaData==NULL)
-	    return JNI_FALSE;
+/**
+ * Returns true if given frame does not have to be decoded to draw the next
+ * one, which is opaque, covers whole screen and does not need canvas to be
+ * saved for its disposal. Frames drawn from replay cache need previous ones.
+ */
+static bool isFrameCovered(const GifInfo* info, int idx)
+{
+	const GifFileType* fGif = info->gifFilePtr;
+	if (info->seekFunction == NULL || info->replayFrames != NULL
+			|| idx + 1 >= fGif->ImageCount)
+		return false;
+	const FrameInfo* next = &info->infos[idx + 1];
+	const GifImageDesc* desc = &fGif->SavedImages[idx + 1].ImageDesc;
+	return next->transpIndex == NO_TRANSPARENT_COLOR
+			&& next->disposalMethod != DISPOSE_PREVIOUS && desc->Left == 0
+			&& desc->Top == 0 && desc->Width >= fGif->SWidth
+			&& desc->Height >= fGif->SHeight;
+}
+
+/**
+ * Extends rect by area changed by given frame.
+ */
+static void addDirtyRect(const GifInfo* info, int idx, GifWord* left,
+		GifWord* top, GifWord* right, GifWord* bottom)
+{
+	GifWord l, t, r, b;
+	getDirtyRect(info, idx, &l, &t, &r, &b);
+	if (r <= l || b <= t)
+		return;
+	*left = l < *left ? l : *left;
+	*top = t < *top ? t : *top;
+	*right = r > *right ? r : *right;
+	*bottom = b > *bottom ? b : *bottom;
+}
 
- 	if (needRedraw)
+/**
+ * Draws current frame and fills error code, dirty rect and time until the
+ * next frame. Frames already overdue as a whole are composited first if
+ * catching up.
+ * @return true if the last frame of the loop was drawn or composited
+ */
+static bool drawDueFrame(GifInfo* info, argb* pixels, RenderMetaData* meta,
+		__time_t rt)
+{
+	RenderStats* stats = &info->stats;
+	//nextStartTime is 0 before the first frame
+	if (info->nextStartTime > 0 && rt - info->nextStartTime >= LATE_FRAME_THRESHOLD)
+		stats->framesLate++;
+	const long long startTime = getMicroTime();
+	TRACE_BEGIN(info, "frame");
+	GifWord left = info->width, top = info->height, right = 0, bottom = 0;
+	const int lastIdx = info->gifFilePtr->ImageCount - 1;
+	int idx = info->currentIndex;
+	int composedCount = 0;
+	bool isLoopCompleted = false;
+	//last frame of the last loop is always presented
+	while (info->framePolicy == FRAME_POLICY_CATCH_UP && info->nextStartTime > 0
+			&& lastIdx > 0 && composedCount < MAX_CATCH_UP_FRAMES
+			&& (idx < lastIdx || info->loopCount == 0
+					|| info->currentLoop + 1 < info->loopCount)
+			&& rt >= info->nextStartTime + (__time_t) getScaledDuration(info, idx))
 	{
-		jint* const pixels = (*env)->GetIntArrayElements(env, jPixels, 0);
-		if (pixels==NULL)
+		if (isFrameCovered(info, idx))
+			stats->framesSkipped++;
+		else
 		{
-		    (*env)->ReleaseIntArrayElements(env, metaData, rawMetaData, 0);
-		    return isAnimationCompleted;
+			getBitmap(pixels, info);
+			composedCount++;
+			stats->framesDropped++;
+			//after an error animation restarts, canvas is presented as it is
+			if (info->currentIndex != idx)
+				break;
 		}
-        getBitmap((argb *) pixels, info);
-		rawMetaData[3] = info->gifFilePtr->Error;
-
-		(*env)->ReleaseIntArrayElements(env, jPixels, pixels, 0);
-		unsigned int scaledDuration = info->infos[info->currentIndex].duration;
-		if (info->speedFactor != 1.0)
+		addDirtyRect(info, idx, &left, &top, &right, &bottom);
+		info->nextStartTime += getScaledDuration(info, idx);
+		if (idx == lastIdx)
 		{
-			scaledDuration /= info->speedFactor;
-			if (scaledDuration<=0)
-			    scaledDuration=1;
-			else if (scaledDuration>INT_MAX)
-			    scaledDuration=INT_MAX;
+			isLoopCompleted = true;
+			idx = info->currentIndex = 0;
 		}
+		else
+			idx = ++info->currentIndex;
+	}
+	if (info->currentIndex == idx)
+		getBitmap(pixels, info);
+	TRACE_END(info, "frame");
+	const long long frameTime = getMicroTime() - startTime;
+	//bucket i counts frames taken [2^i, 2^(i+1)) microseconds
+	int bucket = frameTime > 1 ? 63 - __builtin_clzll((unsigned long long) frameTime) : 0;
+	if (bucket >= FRAME_TIME_BUCKETS)
+		bucket = FRAME_TIME_BUCKETS - 1;
+	stats->frameTimeHistogram[bucket]++;
+	stats->frameTimeTotal += frameTime;
+	stats->framesDrawn++;
+	meta->errorCode = info->gifFilePtr->Error;
+
+	//after an error currentIndex is -1 and whole canvas is reported
+	addDirtyRect(info, info->currentIndex, &left, &top, &right, &bottom);
+	if (right <= left || bottom <= top)
+		left = top = right = bottom = 0;
+	meta->dirtyLeft = left;
+	meta->dirtyTop = top;
+	meta->dirtyRight = right;
+	meta->dirtyBottom = bottom;
+#if MAX_DECODE_THREADS > 0
+	meta->decodedAhead = info->decodeAhead != NULL && info->decodeAhead->keptUp;
+#else
+	meta->decodedAhead = false;
+#endif
+
+	//duration of the frame just drawn, even if it failed and currentIndex was reset
+	const unsigned int scaledDuration = getScaledDuration(info, idx);
+	if (info->framePolicy == FRAME_POLICY_DELAY || info->nextStartTime == 0)
 		info->nextStartTime = rt + scaledDuration;
-		rawMetaData[4] = scaledDuration;
+	else
+	{
+		info->nextStartTime += scaledDuration;
+		if (rt - info->nextStartTime > MAX_FRAME_LAG)
+			info->nextStartTime = rt + scaledDuration;
 	}
+	meta->postInvalidationTime = info->nextStartTime > rt ?
+			(jint) (info->nextStartTime - rt) : 0;
+	return isLoopCompleted || idx == lastIdx;
+}
+
+/**
+ * Fills metadata when no frame has been drawn.
+ */
+static void skipFrame(GifInfo* info, RenderMetaData* meta, __time_t rt)
+{
+	meta->errorCode = info->gifFilePtr->Error;
+	meta->dirtyLeft = meta->dirtyTop = meta->dirtyRight = meta->dirtyBottom = 0;
+	meta->decodedAhead = 0;
+    long delay=info->nextStartTime-rt;
+    if (delay<0)
+        meta->postInvalidationTime = -1;
+    else //no need to check upper bound since info->nextStartTime<=rt+INT_MAX always
+	    meta->postInvalidationTime = (int) delay;
+}
+
+bool renderGifFrame(GifInfo* info, argb* pixels, __time_t rt,
+		RenderMetaData* meta)
+{
+	bool isAnimationCompleted = false;
+	if (advanceFrame(info, rt))
+		isAnimationCompleted = drawDueFrame(info, pixels, meta, rt);
 	else
+		skipFrame(info, meta, rt);
+	return isAnimationCompleted;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_pl_droidsonroids_gif_GifDrawable_renderFrame(JNIEnv * env, jclass class,
+		jintArray jPixels, jlong gifInfo, jintArray metaData)
+{
+	GifInfo* info =(GifInfo*)(intptr_t) gifInfo;
+	if (info == NULL || jPixels==NULL)
+		return JNI_FALSE;
+	__time_t rt = getRealTime();
+	jboolean isAnimationCompleted = JNI_FALSE;
+	RenderMetaData meta;
+	if (advanceFrame(info, rt))
 	{
-	    long delay=info->nextStartTime-rt;
-	    if (delay<0)
-	        rawMetaData[4] = -1;
-	    else //no need to check upper bound since info->nextStartTime<=rt+INT_MAX always
-		    rawMetaData[4] = (int) delay;
+		jint* const pixels = (*env)->GetIntArrayElements(env, jPixels, 0);
+		if (pixels==NULL)
+		    return info->currentIndex >= info->gifFilePtr->ImageCount - 1 ?
+		        JNI_TRUE : JNI_FALSE;
+		isAnimationCompleted = drawDueFrame(info, (argb *) pixels, &meta, rt) ?
+				JNI_TRUE : JNI_FALSE;
+		(*env)->ReleaseIntArrayElements(env, jPixels, pixels, 0);
 	}
-	(*env)->ReleaseIntArrayElements(env, metaData, rawMetaData, 0);
+	else
+		skipFrame(info, &meta, rt);
+
+	//only changed fields are written, dirty rect and decode ahead flag if array is long enough
+	const jsize metaLength = (*env)->GetArrayLength(env, metaData);
+	const jsize fieldCount = metaLength >= 10 ? 7 : metaLength >= 9 ? 6 : 2;
+	(*env)->SetIntArrayRegion(env, metaData, 3, fieldCount, &meta.errorCode);
 	return isAnimationCompleted;
 }
 
+/**
+ * Like renderFrame but draws into registered frame buffer, no Java arrays
+ * are accessed.
+ */
+JNIEXPORT jboolean JNICALL
+Java_pl_droidsonroids_gif_GifDrawable_renderFrameToBuffer(JNIEnv * env,
+		jclass class, jlong gifInfo)
+{
+	GifInfo* info =(GifInfo*)(intptr_t) gifInfo;
+	if (info == NULL || info->frameBufferPixels == NULL)
+		return JNI_FALSE;
+	return renderGifFrame(info, info->frameBufferPixels, getRealTime(),
+			info->frameBufferMetaData) ? JNI_TRUE : JNI_FALSE;
+}
+
+static void releaseFrameBuffer(JNIEnv * env, GifInfo* info)
+{
+	if (info->frameBuffer != NULL)
+		(*env)->DeleteGlobalRef(env, info->frameBuffer);
+	if (info->metaDataBuffer != NULL)
+		(*env)->DeleteGlobalRef(env, info->metaDataBuffer);
+	info->frameBuffer = NULL;
+	info->metaDataBuffer = NULL;
+	info->frameBufferPixels = NULL;
+	info->frameBufferMetaData = NULL;
+}
+
+/**
+ * Registers direct buffers used by renderFrameToBuffer and by seeking without
+ * pixel array. Addresses are resolved here once. Passing NULL unregisters them.
+ */
+JNIEXPORT jboolean JNICALL
+Java_pl_droidsonroids_gif_GifDrawable_setFrameBuffer(JNIEnv * env,
+		jclass class, jlong gifInfo, jobject pixelBuffer, jobject metaDataBuffer)
+{
+	GifInfo* info =(GifInfo*)(intptr_t) gifInfo;
+	if (info == NULL)
+		return JNI_FALSE;
+	releaseFrameBuffer(env, info);
+	if (pixelBuffer == NULL || metaDataBuffer == NULL || info->rasterBits == NULL)
+		return JNI_FALSE;
+
+	argb* const pixels = (*env)->GetDirectBufferAddress(env, pixelBuffer);
+	RenderMetaData* const meta = (*env)->GetDirectBufferAddress(env, metaDataBuffer);
+	const size_t pxBytes = (size_t) info->width * info->height * sizeof(argb);
+	if (pixels == NULL || meta == NULL
+			|| ((intptr_t) pixels | (intptr_t) meta) % sizeof(jint) != 0
+			|| (*env)->GetDirectBufferCapacity(env, pixelBuffer) < (jlong) pxBytes
+			|| (*env)->GetDirectBufferCapacity(env, metaDataBuffer)
+					< (jlong) sizeof(RenderMetaData))
+		return JNI_FALSE;
+
+	info->frameBuffer = (*env)->NewGlobalRef(env, pixelBuffer);
+	info->metaDataBuffer = (*env)->NewGlobalRef(env, metaDataBuffer);
+	if (info->frameBuffer == NULL || info->metaDataBuffer == NULL)
+	{
+		releaseFrameBuffer(env, info);
+		return JNI_FALSE;
+	}
+	info->frameBufferPixels = pixels;
+	info->frameBufferMetaData = meta;
+	meta->width = info->width;
+	meta->height = info->height;
+	meta->imageCount = info->gifFilePtr->ImageCount;
+	meta->errorCode = info->gifFilePtr->Error;
+	meta->postInvalidationTime = -1;
+	meta->dirtyLeft = meta->dirtyTop = meta->dirtyRight = meta->dirtyBottom = 0;
+	meta->decodedAhead = 0;
+	return JNI_TRUE;
+}
+
 JNIEXPORT void JNICALL
 Java_pl_droidsonroids_gif_GifDrawable_free(JNIEnv * env, jclass class,
 		jlong gifInfo)
@@ -1060,6 +3146,10 @@ Java_pl_droidsonroids_gif_GifDrawable_free(JNIEnv * env, jclass class,
 	if (gifInfo == (jlong)(intptr_t) NULL)
 		return;
 	GifInfo* info =(GifInfo*)(intptr_t) gifInfo;
+#if MAX_DECODE_THREADS > 0
+	//worker reads input released below
+	stopDecodeAhead(info);
+#endif
 	if (info->rewindFunction == streamRewind)
 	{
 		StreamContainer* sc = info->gifFilePtr->UserData;
@@ -1078,6 +3168,7 @@ Java_pl_droidsonroids_gif_GifDrawable_free(JNIEnv * env, jclass class,
 			(*env)->DeleteGlobalRef(env, sc->buffer);
 		}
 
+		free(sc->data);
 		free(sc);
 	}
 	else if (info->rewindFunction == fileRewind)
@@ -1090,16 +3181,24 @@ Java_pl_droidsonroids_gif_GifDrawable_free(JNIEnv * env, jclass class,
 		ByteArrayContainer* bac = info->gifFilePtr->UserData;
 		if (bac->buffer != NULL)
 		{
+			(*env)->ReleaseByteArrayElements(env, bac->buffer, bac->bytes, JNI_ABORT);
 			(*env)->DeleteGlobalRef(env, bac->buffer);
 		}
 		free(bac);
 	}
-	else if (info->rewindFunction == directByteBufferRewindFun)
+	else if (info->rewindFunction == mappedFileRewind)
 	{
-		DirectByteBufferContainer* dbbc = info->gifFilePtr->UserData;
-		free(dbbc);
+		MappedFileContainer* mfc = info->gifFilePtr->UserData;
+		munmap(mfc->address, mfc->length);
+		free(mfc);
 	}
 	info->gifFilePtr->UserData = NULL;
+	releaseFrameBuffer(env, info);
+	cleanUp(info);
+}
+
+void closeGif(GifInfo* info)
+{
 	cleanUp(info);
 }
 
@@ -1130,11 +3229,7 @@ Java_pl_droidsonroids_gif_GifDrawable_getDuration(JNIEnv * env, jclass class,
 	GifInfo* info =(GifInfo*)(intptr_t) gifInfo;
 	if (info == NULL)
 		return 0;
-	int i;
-    jint sum = 0;
-	for (i = 0; i < info->gifFilePtr->ImageCount; i++)
-		sum += info->infos[i].duration;
-	return sum;
+	return (jint) info->frameStartTimes[info->gifFilePtr->ImageCount];
 }
 
 JNIEXPORT jint JNICALL
@@ -1147,10 +3242,7 @@ Java_pl_droidsonroids_gif_GifDrawable_getCurrentPosition(JNIEnv * env,
 	int idx = info->currentIndex;
 	if (idx < 0 || info->gifFilePtr->ImageCount <= 1)
 		return 0;
-	int i;
-	unsigned int sum = 0;
-	for (i = 0; i < idx; i++)
-		sum += info->infos[i].duration;
+	const unsigned long sum = info->frameStartTimes[idx];
 	__time_t remainder =
 			info->lastFrameReaminder == ULONG_MAX ?
 					getRealTime() - info->nextStartTime :
@@ -1186,13 +3278,154 @@ Java_pl_droidsonroids_gif_GifDrawable_getAllocationByteCount(JNIEnv * env,
 	GifInfo* info = (GifInfo*)(intptr_t) gifInfo;
 	if (info == NULL)
 		return 0;
-	GifWord pxCount = info->gifFilePtr->SWidth + info->gifFilePtr->SHeight;
-	size_t sum = pxCount * sizeof(char);
-	if (info->backupPtr != NULL)
-		sum += pxCount * sizeof(argb);
+	const GifFileType* fGif = info->gifFilePtr;
+	const GifWord pxCount = info->width * info->height;
+#ifdef DECODE_TO_CANVAS
+	size_t sum = fGif->SWidth * sizeof(char);
+#else
+	size_t sum = fGif->SWidth * fGif->SHeight * sizeof(char);
+#endif
+	sum += info->backupCapacity * sizeof(argb);
+	int i;
+	for (i = 0; i < info->checkpointCount; i++)
+		if (info->checkpoints[i].pixels != NULL)
+			sum += pxCount * sizeof(argb);
+	sum += info->replayBytes;
+	sum += info->colorTableCount * sizeof(ColorTable);
+	sum += DGifGetBufferSize(info->gifFilePtr);
+	sum += info->parallelBytes;
+#if MAX_DECODE_THREADS > 0
+	DecodeAhead* da = info->decodeAhead;
+	if (da != NULL)
+	{
+		sum += fGif->SWidth * fGif->SHeight * sizeof(GifByteType);
+		pthread_mutex_lock(&scheduler.mutex);
+		sum += da->bufferBytes;
+		pthread_mutex_unlock(&scheduler.mutex);
+	}
+#endif
 	return (jlong) sum;
 }
 
+JNIEXPORT jboolean JNICALL
+Java_pl_droidsonroids_gif_GifDrawable_setSeekCheckpoints(JNIEnv * env,
+		jclass class, jlong gifInfo, jint frameInterval, jlong maxBytes)
+{
+	GifInfo* info = (GifInfo*)(intptr_t) gifInfo;
+	if (info == NULL || info->rasterBits == NULL || maxBytes <= 0)
+	{
+		if (info != NULL)
+			freeCheckpoints(info);
+		return JNI_FALSE;
+	}
+	return setupCheckpoints(info, frameInterval, (size_t) maxBytes) ?
+			JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_pl_droidsonroids_gif_GifDrawable_setReplayCache(JNIEnv * env,
+		jclass class, jlong gifInfo, jlong maxBytes)
+{
+	GifInfo* info = (GifInfo*)(intptr_t) gifInfo;
+	if (info == NULL)
+		return JNI_FALSE;
+	//sources which cannot seek are positioned after the last decoded frame
+	if (info->seekFunction == NULL && info->replayFrames != NULL
+			&& info->replayFrameCount == info->gifFilePtr->ImageCount
+			&& info->currentIndex != info->gifFilePtr->ImageCount - 1)
+		reset(info);
+	if (info->rasterBits == NULL || maxBytes <= 0)
+	{
+		freeReplayCache(info);
+		return JNI_FALSE;
+	}
+	return setupReplayCache(info, (size_t) maxBytes) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_pl_droidsonroids_gif_GifDrawable_setDecodeAhead(JNIEnv * env,
+		jclass class, jlong gifInfo, jboolean enabled)
+{
+	GifInfo* info = (GifInfo*)(intptr_t) gifInfo;
+	if (info == NULL)
+		return JNI_FALSE;
+#if MAX_DECODE_THREADS > 0
+	if (enabled == JNI_TRUE)
+		return startDecodeAhead(info) ? JNI_TRUE : JNI_FALSE;
+	stopDecodeAhead(info);
+#endif
+	return JNI_FALSE;
+}
+
+JNIEXPORT void JNICALL
+Java_pl_droidsonroids_gif_GifDrawable_getStats(JNIEnv * env, jclass class,
+		jlong gifInfo, jlongArray statsArray)
+{
+	GifInfo* info = (GifInfo*)(intptr_t) gifInfo;
+	if (info == NULL || statsArray == NULL)
+		return;
+	RenderStats stats = info->stats;
+	unsigned long bytesRead, codeCount;
+	DGifGetCounters(info->gifFilePtr, &bytesRead, &codeCount);
+	stats.bytesRead += bytesRead;
+	stats.codesDecoded += codeCount;
+#if MAX_DECODE_THREADS > 0
+	addDecodeAheadCounters(info, &stats);
+#endif
+	const jsize length = (*env)->GetArrayLength(env, statsArray);
+	const jsize count = sizeof(RenderStats) / sizeof(jlong);
+	(*env)->SetLongArrayRegion(env, statsArray, 0, length < count ? length : count,
+			(const jlong*) &stats);
+}
+
+JNIEXPORT void JNICALL
+Java_pl_droidsonroids_gif_GifDrawable_setDecodePriority(JNIEnv * env,
+		jclass class, jlong gifInfo, jint priority)
+{
+#if MAX_DECODE_THREADS > 0
+	GifInfo* info = (GifInfo*)(intptr_t) gifInfo;
+	if (info == NULL || priority < DECODE_PRIORITY_VISIBLE
+			|| priority > DECODE_PRIORITY_PAUSED)
+		return;
+	setDecodePriority(info, priority);
+#endif
+}
+
+JNIEXPORT jboolean JNICALL
+Java_pl_droidsonroids_gif_GifDrawable_isNextFrameDecoded(JNIEnv * env,
+		jclass class, jlong gifInfo)
+{
+	GifInfo* info = (GifInfo*)(intptr_t) gifInfo;
+	if (info == NULL)
+		return JNI_FALSE;
+#if MAX_DECODE_THREADS > 0
+	return isDecodedAhead(info) ? JNI_TRUE : JNI_FALSE;
+#else
+	return JNI_FALSE;
+#endif
+}
+
+JNIEXPORT void JNICALL
+Java_pl_droidsonroids_gif_GifDrawable_setTracing(JNIEnv * env, jclass class,
+		jboolean enabled)
+{
+	setGifTracing(enabled == JNI_TRUE);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_pl_droidsonroids_gif_GifDrawable_flushTrace(JNIEnv * env, jclass class,
+		jstring jpath)
+{
+	if (jpath == NULL)
+		return JNI_FALSE;
+	const char * const path = (*env)->GetStringUTFChars(env, jpath, 0);
+	if (path == NULL)
+		return JNI_FALSE;
+	const bool ok = writeGifTrace(path);
+	(*env)->ReleaseStringUTFChars(env, jpath, path);
+	return ok ? JNI_TRUE : JNI_FALSE;
+}
+
 jint JNI_OnLoad(JavaVM* vm, void* reserved)
 {
 	JNIEnv* env;
@@ -1201,13 +3434,67 @@ jint JNI_OnLoad(JavaVM* vm, void* reserved)
 		return -1;
 	}
 	g_jvm = vm;
-	defaultCmap = genDefColorMap();
-	if (defaultCmap == NULL)
+	if (!initGifCore())
 		return -1;
 	return JNI_VERSION_1_6;
 }
 
 void JNI_OnUnload(JavaVM* vm, void* reserved)
+{
+	releaseGifCore();
+}
+
+bool initGifCore(void)
+{
+	initKernels();
+	defaultCmap = genDefColorMap();
+	return defaultCmap != NULL;
+}
+
+void releaseGifCore(void)
 {
 	GifFreeMapObject(defaultCmap);
+	defaultCmap = NULL;
+}
+
+void setGifTracing(bool enabled)
+{
+#ifdef GIF_TRACE
+	__atomic_store_n(&tracingEnabled, enabled, __ATOMIC_RELAXED);
+#endif
+}
+
+bool writeGifTrace(const char* path)
+{
+#ifdef GIF_TRACE
+	FILE* file = fopen(path, "a");
+	if (file == NULL)
+		return false;
+	//closing bracket of JSON array format is optional, so later calls can append
+	bool ok = fseek(file, 0, SEEK_END) == 0
+			&& (ftell(file) > 0 || fputs("[\n", file) >= 0);
+	const int pid = getpid();
+	pthread_mutex_lock(&traceMutex);
+	TraceBuffer* buffer;
+	for (buffer = traceBuffers; ok && buffer != NULL; buffer = buffer->next)
+		ok = writeTraceBuffer(file, buffer, pid);
+	pthread_mutex_unlock(&traceMutex);
+	if (fclose(file) != 0)
+		ok = false;
+	return ok;
+#else
+	return false;
+#endif
+}
+
+int sumGifTrace(StageTime* stages, int stageCount, int maxStages)
+{
+#ifdef GIF_TRACE
+	pthread_mutex_lock(&traceMutex);
+	TraceBuffer* buffer;
+	for (buffer = traceBuffers; buffer != NULL; buffer = buffer->next)
+		sumTraceBuffer(buffer, stages, &stageCount, maxStages);
+	pthread_mutex_unlock(&traceMutex);
+#endif
+	return stageCount;
 }
\ No newline at end of file
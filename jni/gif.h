@@ -9,6 +9,10 @@
 #include <stdint.h>
 #include <string.h>
 #include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "giflib/gif_lib.h"
 
 //#include <android/log.h>
@@ -22,6 +26,69 @@
  */
 //#define STRICT_FORMAT_89A
 
+/**
+ * Decode frames line by line straight into the canvas. Palette lookup and
+ * transparency check are done as soon as each line is decoded, so rasterBits
+ * holds one line instead of whole screen and there is no second pass over it.
+ */
+#define DECODE_TO_CANVAS
+
+/**
+ * Maximum number of threads decoding frames in parallel when several frames
+ * are rendered at once (e.g. seeking) from byte array or direct buffer.
+ * Index rasters are then composited in order on the calling thread.
+ * 0 disables parallel decoding and decoding ahead in background.
+ */
+#define MAX_DECODE_THREADS 4
+
+/**
+ * InputStreams are read in chunks of this size, parser reads are served
+ * from native memory.
+ */
+#define STREAM_CHUNK_SIZE 65536
+
+/**
+ * InputStreams up to this size are kept in native memory as a whole once read,
+ * so further loops and seeks do not call Java. Larger ones are read again
+ * after reset. 0 disables spooling.
+ */
+#define STREAM_SPOOL_MAX_BYTES (8 * 1024 * 1024)
+
+/**
+ * Use scalar pixel kernels only. Otherwise SSE2 kernels (AVX2 ones if CPU
+ * supports it) are used on x86 and NEON ones on ARM if compiler targets it.
+ */
+//#define GIF_NO_SIMD
+
+#if !defined(GIF_NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) \
+		&& defined(__SSE2__) && defined(__GNUC__)
+#define GIF_SIMD_X86
+#include <immintrin.h>
+#elif !defined(GIF_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define GIF_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+/**
+ * Record begin and end of decoding stages (open, records, LZW decode, disposal,
+ * blit, rewind) to per-thread ring buffers, written as Chrome trace event JSON
+ * by writeGifTrace or added up per stage by sumGifTrace. Nothing is recorded
+ * until setGifTracing enables it.
+ * Otherwise tracing is compiled out.
+ */
+//#define GIF_TRACE
+
+/**
+ * Events kept per thread, power of 2. The oldest ones are overwritten when
+ * trace is not written often enough.
+ */
+#define TRACE_BUFFER_EVENTS 8192
+
+/**
+ * Maximum nesting of stages added up by sumGifTrace, deeper ones are ignored.
+ */
+#define TRACE_STAGE_DEPTH 16
+
 
 /**
  * Decoding error - no frames
@@ -46,11 +113,171 @@ typedef struct
 	unsigned int duration;
 	int transpIndex;
 	unsigned char disposalMethod;
+	long descPos; //image descriptor, just after its separator, -1 if unknown
+	long dataPos; //LZW minimum code size byte, -1 if unknown
+	const argb* colorTable; //256 entries shared by frames, NULL if not built
 } FrameInfo;
 
+typedef struct
+{
+	uint32_t hash;
+	argb colors[256]; //transparent entry has alpha 0, all others are opaque
+} ColorTable;
+
+typedef struct
+{
+	int frameIndex; //frame composited in pixels, -1 if not captured yet
+	argb* pixels;
+} Checkpoint;
+
+typedef struct
+{
+	argb colors[256];
+	int colorCount;
+	uint32_t hashColors[512];
+	int16_t hashIndices[512]; //index of color in colors, -1 if slot is empty
+} ReplayPalette;
+
+typedef struct
+{
+	GifWord left, top, width, height; //area which may differ from previous frame
+	argb* pixels; //NULL if indices are used
+	uint8_t* indices;
+	const ReplayPalette* palette;
+} ReplayFrame;
+
+/**
+ * Layout of metadata buffer registered by setFrameBuffer, same as metadata
+ * array passed to renderFrame.
+ */
+typedef struct
+{
+	jint width;
+	jint height;
+	jint imageCount;
+	jint errorCode;
+	jint postInvalidationTime; //-1 if next frame is already due
+	jint dirtyLeft, dirtyTop, dirtyRight, dirtyBottom; //all 0 if nothing changed
+	jint decodedAhead; //1 if frame had been decoded in background before it was due
+} RenderMetaData;
+
+/**
+ * Number of buckets of frame time histogram. Bucket i counts frames drawn in
+ * [2^i, 2^(i+1)) microseconds, the first and the last one are open ended.
+ */
+#define FRAME_TIME_BUCKETS 16
+
+/**
+ * Frames drawn this many milliseconds or more after they were due are late.
+ */
+#define LATE_FRAME_THRESHOLD 20
+
+/**
+ * Policies of scheduling frames, see setGifFramePolicy.
+ * DELAY: next frame is due its duration after the current one is drawn, so
+ * late draws postpone all further frames.
+ * DRIFT_FREE: frames are due at fixed intervals, frames following a late one
+ * are drawn sooner until animation is back on time.
+ * CATCH_UP: like DRIFT_FREE, but frames whose whole duration has already
+ * passed are composited without being presented. Those completely covered by
+ * the next frame are not decoded at all.
+ */
+#define FRAME_POLICY_DELAY 0
+#define FRAME_POLICY_DRIFT_FREE 1
+#define FRAME_POLICY_CATCH_UP 2
+
+/**
+ * Animation more than this many milliseconds behind is rescheduled from the
+ * current time instead of being caught up.
+ */
+#define MAX_FRAME_LAG 1000
+
+/**
+ * Maximum number of frames composited without being presented per rendered
+ * frame, the rest is caught up during next ones.
+ */
+#define MAX_CATCH_UP_FRAMES 8
+
+/**
+ * Counters of a GifInfo, layout of array filled by getStats.
+ */
+typedef struct
+{
+	jlong framesDrawn; //when due, frames drawn while seeking are not included
+	jlong framesLate;
+	jlong rewinds;
+	jlong bytesRead; //input consumed by all readers, skipped image data excluded
+	jlong codesDecoded; //LZW codes
+	jlong frameTimeTotal; //microseconds spent drawing frames
+	jlong frameTimeHistogram[FRAME_TIME_BUCKETS];
+	jlong framesDropped; //composited without being presented while catching up
+	jlong framesSkipped; //not decoded at all while catching up
+} RenderStats;
+
+#ifdef GIF_TRACE
+#include <sys/syscall.h>
+
+/**
+ * Fields are accessed atomically, seq is index of event in thread's buffer
+ * plus 1 once written, 0 while being written.
+ */
+typedef struct
+{
+	uint64_t seq;
+	long long time; //nanoseconds of monotonic clock
+	const char* name; //string literal
+	const void* gif; //GifInfo the stage belongs to, NULL if none
+	long tid;
+	int phase; //'B' or 'E'
+} TraceEvent;
+
+typedef struct TraceBuffer TraceBuffer;
+struct TraceBuffer
+{
+	TraceEvent events[TRACE_BUFFER_EVENTS];
+	uint64_t head; //events written so far, only owner thread writes it
+	uint64_t flushed; //events written to file so far
+	bool owned; //buffer is used by live thread, freed ones are reused
+	uint64_t summed; //events added up by sumGifTrace so far
+	int openStages; //stages begun but not yet ended when events were added up
+	TraceEvent stageBegins[TRACE_STAGE_DEPTH];
+	TraceBuffer* next;
+};
+
+typedef struct
+{
+	const void* gif;
+	const char* name; //NULL if tracing was disabled at begin
+} TraceScope;
+
+#define TRACE_CONCAT(a, b) a##b
+#define TRACE_SCOPE_VAR(line) TRACE_CONCAT(traceScope, line)
+/**
+ * Records begin of stage and its end when enclosing block is left.
+ */
+#define TRACE_SCOPE(gif, name) TraceScope TRACE_SCOPE_VAR(__LINE__) \
+		__attribute__((cleanup(endTraceScope))) = beginTraceScope(gif, name)
+#define TRACE_BEGIN(gif, name) traceEvent(gif, name, 'B')
+#define TRACE_END(gif, name) traceEvent(gif, name, 'E')
+#else
+#define TRACE_SCOPE(gif, name)
+#define TRACE_BEGIN(gif, name)
+#define TRACE_END(gif, name)
+#endif
+
+typedef void
+(*CopyLineFunc)(argb*, const GifByteType*, const argb*, int, int);
+typedef void
+(*FillFunc)(argb*, argb, int);
+
 typedef struct GifInfo GifInfo;
+typedef struct DecodeAhead DecodeAhead;
 typedef int
 (*RewindFunc)(GifInfo *);
+typedef int
+(*SeekFunc)(GifInfo *, long);
+typedef long
+(*TellFunc)(GifInfo *);
 
 struct GifInfo
 {
@@ -59,35 +286,194 @@ struct GifInfo
 	__time_t nextStartTime;
 	int currentIndex;
     FrameInfo* infos;
-	argb* backupPtr;
+	unsigned long* frameStartTimes; //ImageCount + 1 entries, last one is loop duration
+	Checkpoint* checkpoints; //one per checkpointInterval frames, NULL if disabled
+	int checkpointCount;
+	int checkpointInterval;
+	ReplayFrame* replayFrames; //one per frame, NULL if replay cache is disabled
+	int replayFrameCount; //frames captured so far, all of them are replayed then
+	size_t replayBytes;
+	size_t replayBudget;
+	ReplayPalette** replayPalettes; //colors are only appended so palettes can be shared
+	int replayPaletteCount;
+	ColorTable** colorTables; //distinct tables used by frames
+	int colorTableCount;
+	argb* backupPtr; //canvas area under last frame disposed to previous
+	size_t backupCapacity; //pixels, largest such area
+	int sampleSize; //canvas keeps every sampleSize-th pixel of every sampleSize-th row
+	GifWord width; //canvas dimensions, screen ones divided by sampleSize and rounded up
+	GifWord height;
 	long startPos;
-	unsigned char* rasterBits;
+	unsigned char* rasterBits; //one line if DECODE_TO_CANVAS, whole screen otherwise
 	char* comment;
 	unsigned short loopCount;
 	int currentLoop;
 	RewindFunc rewindFunction;
+	SeekFunc seekFunction; //NULL if source cannot seek
+	TellFunc tellFunction;
 	jfloat speedFactor;
+	int framePolicy; //one of FRAME_POLICY_* values
+	jobject frameBuffer; //global refs of buffers registered by setFrameBuffer
+	jobject metaDataBuffer;
+	argb* frameBufferPixels; //NULL if no buffers are registered
+	RenderMetaData* frameBufferMetaData;
+	DecodeAhead* decodeAhead; //NULL if frames are not decoded ahead
+	size_t parallelBytes; //peak of buffers allocated by last parallel decoding
+	RenderStats stats; //counters of gifFilePtr and decodeAhead readers are added when read
 };
 
+#if MAX_DECODE_THREADS > 0
+typedef struct
+{
+	GifInfo* info;
+	const GifByteType* data;
+	unsigned long dataSize;
+	int nextIdx; //next frame to be claimed by a worker
+	int lastIdx;
+	int composedIdx; //last frame composited by calling thread
+	int failedIdx; //first frame which could not be decoded, INT_MAX if none
+	int failedError;
+	unsigned long bytesRead; //counters of finished workers' readers
+	unsigned long codeCount;
+	unsigned long bufferBytes; //decoder buffers of finished workers' readers
+	int slotCount;
+	GifByteType** slots; //frame i is decoded to slot i % slotCount
+	int* slotFrames; //frame decoded in each slot, -1 if none
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} ParallelDecoder;
+
+/**
+ * Priorities of instances decoding ahead, lower ones are served first by
+ * shared scheduler. Paused instances are not decoded at all.
+ */
+#define DECODE_PRIORITY_VISIBLE 0
+#define DECODE_PRIORITY_BACKGROUND 1
+#define DECODE_PRIORITY_PAUSED 2
+
+struct DecodeAhead
+{
+	const GifInfo* info;
+	GifFileType* reader; //worker's own decoder state and input position
+	GifByteType* raster; //index raster of frame decoded in background
+	int requestedIdx; //frame to be decoded next, -1 if none
+	int readyIdx; //frame decoded in raster, -1 if none
+	int failedIdx; //frame which could not be decoded, -1 if none
+	__time_t deadline; //time when requested frame is due
+	int priority; //one of DECODE_PRIORITY_* values
+	int queuePos; //position in scheduler queue, -1 if not queued
+	unsigned long bytesRead; //counters of reader, updated when job is finished
+	unsigned long codeCount;
+	unsigned long bufferBytes; //decoder buffers of reader, updated when job is finished
+	bool busy; //requested frame is being decoded by pool thread
+	bool keptUp; //last frame was ready before it was due, used by calling thread only
+};
+
+/**
+ * Process-wide pool decoding frames ahead for all instances, earliest
+ * deadline first within each priority.
+ */
+typedef struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t workCond; //signalled when job is queued
+	pthread_cond_t doneCond; //broadcast when job is finished
+	DecodeAhead** queue; //binary min-heap ordered by priority and deadline
+	int queueSize;
+	int queueCapacity;
+	int threadCount;
+} DecodeScheduler;
+#endif
+
 typedef struct
 {
 	jobject stream;
 	jclass streamCls;
 	jmethodID readMID;
 	jmethodID resetMID;
-	jbyteArray buffer;
+	jbyteArray buffer; //chunk passed to read
+	GifByteType* data; //read ahead bytes, whole stream read so far if spooled
+	size_t dataLength;
+	size_t dataCapacity;
+	size_t dataPos; //next byte to be parsed
+	long dataStart; //stream position of data[0]
+	bool spooled;
+	bool eof;
 } StreamContainer;
 
 typedef struct
 {
-	long pos;
 	jbyteArray buffer;
-	jsize arrLen;
+	jbyte* bytes;
 } ByteArrayContainer;
 
 typedef struct
 {
-	long pos;
-	jbyte* bytes;
-	jlong capacity;
-} DirectByteBufferContainer;
\ No newline at end of file
+	void* address; //start of mapping, page aligned
+	size_t length;
+} MappedFileContainer;
+
+/**
+ * Entry points not depending on JVM, JNI functions are built on top of them.
+ * Host programs, eg. benchmarks in tools/bench, can use them linking gif.c with
+ * any jni.h.
+ * initGifCore has to be called once before anything else, JNI_OnLoad does it.
+ * @return false if memory is exhausted
+ */
+bool initGifCore(void);
+void releaseGifCore(void);
+
+/**
+ * Opens GIF from memory, which has to remain valid until it is closed.
+ * Canvas dimensions, frame count and error code are stored in meta.
+ * @return NULL on error
+ */
+GifInfo* openGifMemory(const GifByteType* data, unsigned long size,
+		bool justDecodeMetaData, int sampleSize, RenderMetaData* meta);
+
+/**
+ * Draws next frame into pixels if it is due at given time, in milliseconds of
+ * monotonic clock. Fields of meta other than canvas dimensions and frame count
+ * are filled like by renderFrame.
+ * @return true if the last frame of the loop was drawn
+ */
+bool renderGifFrame(GifInfo* info, argb* pixels, __time_t rt,
+		RenderMetaData* meta);
+
+void closeGif(GifInfo* info);
+
+/**
+ * Sets one of FRAME_POLICY_* values, FRAME_POLICY_DELAY is used by default.
+ */
+void setGifFramePolicy(GifInfo* info, int policy);
+
+/**
+ * Starts or stops recording of trace events, no-op if GIF_TRACE is not defined.
+ */
+void setGifTracing(bool enabled);
+
+/**
+ * Appends events recorded since the previous call, by all threads, to a
+ * Chrome trace event JSON file, which is created if needed.
+ * @return false if GIF_TRACE is not defined or file cannot be written
+ */
+bool writeGifTrace(const char* path);
+
+/**
+ * Time spent in a stage of decoding, see sumGifTrace.
+ */
+typedef struct
+{
+	const char* name; //eg. "metadata", "decode", "dispose"
+	long long nanos; //nested stages are included in enclosing ones
+	long count;
+} StageTime;
+
+/**
+ * Adds durations of stages ended since the previous call, by all threads, to
+ * entries of stages with the same name. Entries of other stages are appended
+ * while there is room for them. Stages whose events were overwritten before
+ * this call are lost.
+ * @return number of entries used, stageCount if GIF_TRACE is not defined
+ */
+int sumGifTrace(StageTime* stages, int stageCount, int maxStages);
\ No newline at end of file
@@ -26,26 +26,128 @@ two modules will be linked.  Preserve this property!
 /* compose unsigned little endian value */
 #define UNSIGNED_LITTLE_ENDIAN(lo, hi)	((lo) | ((hi) << 8))
 
-/* avoid extra function call in case we use fread (TVT) */
-#define READ(_gif,_buf,_len)                                     \
-  (((GifFilePrivateType*)_gif->Private)->Read ?                   \
-    ((GifFilePrivateType*)_gif->Private)->Read(_gif,_buf,_len) : \
-    fread(_buf,1,_len,((GifFilePrivateType*)_gif->Private)->File))
+/* read memory input in place, avoid extra function call otherwise (TVT) */
+#define READ(_gif,_buf,_len) DGifRead(_gif,(GifByteType *)(_buf),_len)
 
+static inline int DGifRead(GifFileType *GifFile, GifByteType *Buf, int Len);
+static GifFileType *DGifOpenInternal(void *userData, InputFunc readFunc,
+                                     const GifByteType *Data,
+                                     unsigned long Size, int *Error);
 static int DGifGetWord(GifFileType *GifFile, GifWord *Word);
 static int DGifSetupDecompress(GifFileType *GifFile);
 static int DGifDecompressLine(GifFileType *GifFile, GifPixelType *Line,
                               int LineLen);
+#ifdef GIF_LZW_TABLE_DECODER
+static int DGifSetupHistory(GifFileType *GifFile, int LineLen);
+static void DGifCopyString(GifByteType *Out, unsigned long Mask,
+                           unsigned long Dst, unsigned long Src,
+                           unsigned long Len);
+static void DGifTraceString(const GifFilePrivateType *Private,
+                            GifByteType *Out, unsigned long Mask,
+                            unsigned long Dst, unsigned long Len, int Code);
+static void DGifCopyLine(GifPixelType *Line, const GifByteType *Out,
+                         unsigned long Mask, unsigned long Src,
+                         unsigned long Len);
+#else
 static int DGifGetPrefixChar(GifPrefixType *Prefix, int Code, int ClearCode);
-static int DGifDecompressInput(GifFileType *GifFile, int *Code);
-static int DGifBufferedInput(GifFileType *GifFile, GifByteType *Buf,
-                             GifByteType *NextByte);
+#endif
+static int DGifGatherCode(GifFileType *GifFile);
+static inline int DGifDecompressInput(GifFileType *GifFile, int *Code);
 
 /******************************************************************************
  GifFileType constructor with user supplied input function (TVT)
 ******************************************************************************/
 GifFileType *
 DGifOpen(void *userData, InputFunc readFunc, int *Error)
+{
+    return DGifOpenInternal(userData, readFunc, NULL, 0, Error);
+}
+
+/******************************************************************************
+ GifFileType constructor reading Size bytes of Data directly, without calls
+ to input function. Data must remain valid until DGifCloseFile.
+******************************************************************************/
+GifFileType *
+DGifOpenMem(void *userData, const GifByteType *Data, unsigned long Size,
+            int *Error)
+{
+    return DGifOpenInternal(userData, NULL, Data, Size, Error);
+}
+
+/******************************************************************************
+ Returns current position of memory input or -1 if input is not in memory.
+******************************************************************************/
+long
+DGifTellMem(GifFileType *GifFile)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    if (Private->Mem == NULL)
+        return -1;
+    return (long)Private->MemPos;
+}
+
+/******************************************************************************
+ Returns data memory input was opened with and stores its length in Size,
+ NULL if input is not in memory. Several GifFileTypes may read the same data.
+******************************************************************************/
+const GifByteType *
+DGifGetMem(GifFileType *GifFile, unsigned long *Size)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    *Size = Private->MemSize;
+    return Private->Mem;
+}
+
+/******************************************************************************
+ Returns number of input bytes consumed and LZW codes decoded so far. Image
+ data skipped by DGifSkipCode is not counted.
+******************************************************************************/
+void
+DGifGetCounters(GifFileType *GifFile, unsigned long *BytesRead,
+                unsigned long *CodeCount)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    *BytesRead = Private->BytesRead;
+    *CodeCount = Private->CodeCount;
+}
+
+/******************************************************************************
+ Returns number of bytes allocated by decoder for image data and decoded
+ pixels, neither of them is released until file is closed.
+******************************************************************************/
+unsigned long
+DGifGetBufferSize(GifFileType *GifFile)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+#ifdef GIF_LZW_TABLE_DECODER
+    return Private->CodeBufSize + Private->HistorySize;
+#else
+    return Private->CodeBufSize;
+#endif
+}
+
+/******************************************************************************
+ Moves memory input to given position, which should be a record boundary.
+******************************************************************************/
+int
+DGifSeekMem(GifFileType *GifFile, long Pos)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    if (Private->Mem == NULL || Pos < 0 ||
+        (unsigned long)Pos > Private->MemSize)
+        return GIF_ERROR;
+    Private->MemPos = (unsigned long)Pos;
+    return GIF_OK;
+}
+
+static GifFileType *
+DGifOpenInternal(void *userData, InputFunc readFunc, const GifByteType *Data,
+                 unsigned long Size, int *Error)
 {
     char Buf[GIF_STAMP_LEN + 1];
     GifFileType *GifFile;
@@ -76,8 +178,19 @@ DGifOpen(void *userData, InputFunc readFunc, int *Error)
 //    Private->FileHandle = 0;
     Private->File = NULL;
     Private->FileState = FILE_STATE_READ;
+    Private->CodeBuf = NULL;
+    Private->CodeBufSize = 0;
+#ifdef GIF_LZW_TABLE_DECODER
+    Private->History = NULL;
+    Private->HistorySize = 0;
+#endif
 
     Private->Read = readFunc;    /* TVT */
+    Private->Mem = Data;
+    Private->MemSize = Size;
+    Private->MemPos = 0;
+    Private->BytesRead = 0;
+    Private->CodeCount = 0;
     GifFile->UserData = userData;    /* TVT */
 
     /* Lets see if this is a GIF file: */
@@ -276,6 +389,14 @@ DGifGetImageDesc(GifFileType *GifFile, bool changeImageCount)
             GifFile->Image.ColorMap->Colors[i].Blue = Buf[2];
         }
     }
+
+    /* Reset decompress algorithm parameters. Image is not added if its LZW
+     * code size cannot be read. */
+    if (DGifSetupDecompress(GifFile) == GIF_ERROR) {
+        GifFreeMapObject(GifFile->Image.ColorMap);
+        GifFile->Image.ColorMap = NULL;
+        return GIF_ERROR;
+    }
    // if (changeImageCount)
     {
 		if (GifFile->SavedImages) {
@@ -313,19 +434,45 @@ DGifGetImageDesc(GifFileType *GifFile, bool changeImageCount)
     Private->PixelCount = (long)GifFile->Image.Width *
        (long)GifFile->Image.Height;
 
-    /* Reset decompress algorithm parameters. */
-    (void)DGifSetupDecompress(GifFile);
-
     return GIF_OK;
 }
 
+/******************************************************************************
+ Prepare reading of an image whose descriptor (and local color map) was read
+ before, e.g. on a previous pass, without parsing them again. The input must
+ be positioned at the LZW minimum code size byte of that image. Only the
+ geometry of ImageDesc is used, GifFile->Image.ColorMap is left untouched.
+******************************************************************************/
+int
+DGifStartImage(GifFileType *GifFile, const GifImageDesc *ImageDesc)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    if (!IS_READABLE(Private)) {
+        /* This file was NOT open for reading: */
+        GifFile->Error = D_GIF_ERR_NOT_READABLE;
+        return GIF_ERROR;
+    }
+
+    GifFile->Image.Left = ImageDesc->Left;
+    GifFile->Image.Top = ImageDesc->Top;
+    GifFile->Image.Width = ImageDesc->Width;
+    GifFile->Image.Height = ImageDesc->Height;
+    GifFile->Image.Interlace = ImageDesc->Interlace;
+
+    Private->PixelCount = (long)GifFile->Image.Width *
+       (long)GifFile->Image.Height;
+
+    /* Reset decompress algorithm parameters. */
+    return DGifSetupDecompress(GifFile);
+}
+
 /******************************************************************************
  Get one full scanned line (Line) of length LineLen from GIF file.
 ******************************************************************************/
 int
 DGifGetLine(GifFileType *GifFile, GifPixelType *Line, int LineLen)
 {
-    GifByteType *Dummy;
     GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
 
     if (!IS_READABLE(Private)) {
@@ -342,21 +489,12 @@ DGifGetLine(GifFileType *GifFile, GifPixelType *Line, int LineLen)
         return GIF_ERROR;
     }
 
-    if (DGifDecompressLine(GifFile, Line, LineLen) == GIF_OK) {
-        if (Private->PixelCount == 0) {
-            /* We probably won't be called any more, so let's clean up
-             * everything before we return: need to flush out all the
-             * rest of image until an empty block (size 0)
-             * detected. We use GetCodeNext.
-	     */
-            do
-                if (DGifGetCodeNext(GifFile, &Dummy) == GIF_ERROR)
-                    return GIF_ERROR;
-            while (Dummy != NULL) ;
-        }
-        return GIF_OK;
-    } else
+    /* All the data blocks, up to an empty one, are read on first call, so
+     * there is nothing left to flush out after the last line. */
+    if (Private->CodePtr == NULL && DGifGatherCode(GifFile) == GIF_ERROR)
         return GIF_ERROR;
+
+    return DGifDecompressLine(GifFile, Line, LineLen);
 }
 
 /******************************************************************************
@@ -483,6 +621,10 @@ DGifCloseFile(GifFileType *GifFile)
         return GIF_ERROR;
     }
 
+    free(Private->CodeBuf);
+#ifdef GIF_LZW_TABLE_DECODER
+    free(Private->History);
+#endif
     free((char *)GifFile->Private);
 
     /* 
@@ -496,6 +638,29 @@ DGifCloseFile(GifFileType *GifFile)
     return GIF_OK;
 }
 
+/******************************************************************************
+ Read Len bytes from memory or from input function. Returns number of bytes
+ actually read.
+******************************************************************************/
+static inline int
+DGifRead(GifFileType *GifFile, GifByteType *Buf, int Len)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    if (Private->Mem != NULL) {
+        if ((unsigned long)Len > Private->MemSize - Private->MemPos)
+            Len = (int)(Private->MemSize - Private->MemPos);
+        memcpy(Buf, Private->Mem + Private->MemPos, (size_t)Len);
+        Private->MemPos += Len;
+    } else if (Private->Read)
+        Len = Private->Read(GifFile, Buf, Len);
+    else
+        Len = (int)fread(Buf, 1, (size_t)Len, Private->File);
+    if (Len > 0)
+        Private->BytesRead += Len;
+    return Len;
+}
+
 /******************************************************************************
  Get 2 bytes (word) from the given file:
 ******************************************************************************/
@@ -571,18 +736,73 @@ DGifGetCodeNext(GifFileType *GifFile, GifByteType **CodeBlock)
     return GIF_OK;
 }
 
+/******************************************************************************
+ Skips compressed image data up to and including the block terminator,
+ without copying it. Memory input only moves its cursor, other inputs read
+ sub-block lengths and skip payloads using skipFunc, or read them if it is NULL.
+******************************************************************************/
+int
+DGifSkipCode(GifFileType *GifFile, SkipFunc skipFunc)
+{
+    GifByteType Buf;
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    if (!IS_READABLE(Private)) {
+        /* This file was NOT open for reading: */
+        GifFile->Error = D_GIF_ERR_NOT_READABLE;
+        return GIF_ERROR;
+    }
+
+    if (Private->Mem != NULL) {
+        unsigned long Pos = Private->MemPos;
+        do {
+            if (Pos >= Private->MemSize ||
+                Private->Mem[Pos] >= Private->MemSize - Pos) {
+                Private->MemPos = Private->MemSize;
+                GifFile->Error = D_GIF_ERR_READ_FAILED;
+                return GIF_ERROR;
+            }
+            Buf = Private->Mem[Pos];
+            Pos += Buf + 1;
+        } while (Buf > 0);
+        Private->MemPos = Pos;
+    } else {
+        do {
+            /* coverity[tainted_data_argument] */
+            if (READ(GifFile, &Buf, 1) != 1 ||
+                (Buf > 0 && (skipFunc != NULL ?
+                             skipFunc(GifFile, Buf) :
+                             READ(GifFile, &Private->Buf[1], Buf)) != Buf)) {
+                GifFile->Error = D_GIF_ERR_READ_FAILED;
+                return GIF_ERROR;
+            }
+        } while (Buf > 0);
+    }
+    Private->Buf[0] = 0;    /* Make sure the buffer is empty! */
+    Private->PixelCount = 0;    /* And local info. indicate image read. */
+
+    return GIF_OK;
+}
+
 /******************************************************************************
  Setup the LZ decompression for this image:
 ******************************************************************************/
 static int
 DGifSetupDecompress(GifFileType *GifFile)
 {
-    int i, BitsPerPixel;
+    int BitsPerPixel;
     GifByteType CodeSize;
-    GifPrefixType *Prefix;
     GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
 
-    READ(GifFile, &CodeSize, 1);    /* Read Code size from file. */
+    if (READ(GifFile, &CodeSize, 1) != 1) {    /* Read Code size from file. */
+        GifFile->Error = D_GIF_ERR_READ_FAILED;
+        return GIF_ERROR;
+    }
+    /* Pixels are bytes, GIF does not allow larger code sizes. */
+    if (CodeSize > 8) {
+        GifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
+        return GIF_ERROR;
+    }
     BitsPerPixel = CodeSize;
 
     Private->Buf[0] = 0;    /* Input Buffer empty. */
@@ -596,14 +816,272 @@ DGifSetupDecompress(GifFileType *GifFile)
     Private->LastCode = NO_SUCH_CODE;
     Private->CrntShiftState = 0;    /* No information in CrntShiftDWord. */
     Private->CrntShiftDWord = 0;
+    Private->CodePtr = NULL;    /* Data blocks not gathered yet. */
+    Private->CodeEnd = NULL;
+
+#ifdef GIF_LZW_TABLE_DECODER
+    Private->Out = NULL;
+    Private->OutPos = 0;
+    Private->LinePos = 0;
+    memset(Private->StringLen, 0, sizeof(Private->StringLen));
+#else
+    {
+        int i;
+        GifPrefixType *Prefix = Private->Prefix;
+        for (i = 0; i <= LZ_MAX_CODE; i++)
+            Prefix[i] = NO_SUCH_CODE;
+    }
+#endif
 
-    Prefix = Private->Prefix;
-    for (i = 0; i <= LZ_MAX_CODE; i++)
-        Prefix[i] = NO_SUCH_CODE;
+    return GIF_OK;
+}
+
+#ifdef GIF_LZW_TABLE_DECODER
+/******************************************************************************
+ Sets up History as a window of the latest output for an image read in
+ pieces of at most LineLen pixels. Its size is a power of two, large enough
+ for a line and two strings (one being emitted, one it may be copied from),
+ and up to HISTORY_MIN_SIZE pixels of earlier output. History is kept for
+ subsequent images and only grows.
+******************************************************************************/
+static int
+DGifSetupHistory(GifFileType *GifFile, int LineLen)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
+    unsigned long ImageSize = (unsigned long)GifFile->Image.Width *
+       (unsigned long)GifFile->Image.Height;
+    unsigned long LineSize = (unsigned long)GifFile->Image.Width >
+       (unsigned long)LineLen ? (unsigned long)GifFile->Image.Width :
+       (unsigned long)LineLen;
+    unsigned long Want = ImageSize < HISTORY_MIN_SIZE ? ImageSize :
+       HISTORY_MIN_SIZE;
+    unsigned long Size = 1;
+
+    if (Want < LineSize + HISTORY_STRING_SLACK)
+        Want = LineSize + HISTORY_STRING_SLACK;
+    while (Size < Want)
+        Size <<= 1;
+    if (Private->HistorySize < Size) {
+        GifByteType *History = realloc(Private->History, Size);
+        if (History == NULL) {
+            GifFile->Error = D_GIF_ERR_NOT_ENOUGH_MEM;
+            return GIF_ERROR;
+        }
+        Private->History = History;
+        Private->HistorySize = Size;
+    }
+    Private->Out = Private->History;
+    Private->OutMask = Private->HistorySize - 1;
+    return GIF_OK;
+}
+
+/******************************************************************************
+ The LZ decompression routine, table driven version:
+ Every code above EOFCode is kept as position, length and first pixel of its
+ string in output of the current image. A string is the string of the
+ previous code followed by the first pixel of the current one, which is
+ exactly where the previous code was emitted, so each code is emitted with
+ a single copy of earlier output.
+ If the whole image is requested at once Out is Line itself and strings are
+ always found there. Otherwise pixels are decoded into History, a window of
+ the latest output indexed by position & OutMask, and copied to Line. Whole
+ strings are decoded there, so it may be ahead of the lines returned so far.
+ Strings which are no longer in the window are emitted from Prefix and
+ Suffix tables instead.
+******************************************************************************/
+static int
+DGifDecompressLine(GifFileType *GifFile, GifPixelType *Line, int LineLen)
+{
+    int CrntCode, EOFCode, ClearCode, LastCode;
+    unsigned long Pos, End, Len, Mask;
+    GifByteType *Out;
+    GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
+
+    if (Private->Out == NULL) {
+        if (Private->PixelCount == 0) {    /* Whole image in one call. */
+            Private->Out = Line;
+            Private->OutMask = ~0UL;
+        } else if (DGifSetupHistory(GifFile, LineLen) == GIF_ERROR)
+            return GIF_ERROR;
+    }
+
+    Out = Private->Out;
+    Mask = Private->OutMask;
+    EOFCode = Private->EOFCode;
+    ClearCode = Private->ClearCode;
+    LastCode = Private->LastCode;
+    Pos = Private->OutPos;
+    if (Out == Line)
+        End = Pos + LineLen;
+    else {
+        if ((unsigned long)LineLen > Mask + 1 - HISTORY_STRING_SLACK) {
+            GifFile->Error = D_GIF_ERR_DATA_TOO_BIG;
+            return GIF_ERROR;
+        }
+        End = Private->LinePos + LineLen;
+    }
+
+    while (Pos < End) {    /* Decode LineLen items. */
+        if (DGifDecompressInput(GifFile, &CrntCode) == GIF_ERROR)
+            return GIF_ERROR;
+
+        if (CrntCode == EOFCode) {
+            /* Note however that usually we will not be here as we will stop
+             * decoding as soon as we got all the pixel, or EOF code will
+             * not be read at all, and DGifGetLine/Pixel clean everything.  */
+            GifFile->Error = D_GIF_ERR_EOF_TOO_SOON;
+            return GIF_ERROR;
+        } else if (CrntCode == ClearCode) {
+            /* We need to start over again: */
+            memset(Private->StringLen, 0, sizeof(Private->StringLen));
+            Private->RunningCode = Private->EOFCode + 1;
+            Private->RunningBits = Private->BitsPerPixel + 1;
+            Private->MaxCode1 = 1 << Private->RunningBits;
+            LastCode = Private->LastCode = NO_SUCH_CODE;
+        } else {
+            GifByteType First;
+            unsigned long Src;
+
+            if (CrntCode < ClearCode) {
+                /* This is simple - its pixel scalar, so add it to output: */
+                First = (GifByteType)CrntCode;
+                Src = Pos;
+                Len = 1;
+                Out[Pos & Mask] = First;
+            } else if (Private->StringLen[CrntCode] != 0) {
+                First = Private->StringFirst[CrntCode];
+                Src = Private->StringPos[CrntCode];
+                Len = Private->StringLen[CrntCode];
+            } else if (CrntCode == Private->RunningCode - 2 &&
+                       LastCode != NO_SUCH_CODE) {
+                /* Only allowed if CrntCode is exactly the running code:
+                 * In that case CrntCode = XXXCode, CrntCode or the
+                 * prefix code is last code and the suffix char is
+                 * exactly the prefix of last code! */
+                First = LastCode < ClearCode ? (GifByteType)LastCode :
+                   Private->StringFirst[LastCode];
+                Src = Private->LastPos;
+                Len = Private->LastLen + 1;
+            } else {
+                GifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
+                return GIF_ERROR;
+            }
+
+            if (LastCode != NO_SUCH_CODE &&
+                Private->StringLen[Private->RunningCode - 2] == 0) {
+                /* New string is the last one and First, emitted right
+                 * after it: */
+                int NewCode = Private->RunningCode - 2;
+                if (Private->LastLen >= LZ_MAX_CODE) {
+                    GifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
+                    return GIF_ERROR;
+                }
+                Private->StringPos[NewCode] = (uint32_t)Private->LastPos;
+                Private->StringLen[NewCode] =
+                   (unsigned short)(Private->LastLen + 1);
+                Private->StringFirst[NewCode] = LastCode < ClearCode ?
+                   (GifByteType)LastCode : Private->StringFirst[LastCode];
+                Private->Prefix[NewCode] = (GifPrefixType)LastCode;
+                Private->Suffix[NewCode] = First;
+            }
+
+            Private->LastPos = Pos;
+            Private->LastLen = Len;
+            if (CrntCode < ClearCode)
+                Pos++;
+            else {
+                /* Rest of a string past the whole image is dropped. */
+                if (Out == Line && Len > End - Pos)
+                    Len = End - Pos;
+                if (Pos + Len - Src - 1 <= Mask)
+                    DGifCopyString(Out, Mask, Pos, Src, Len);
+                else
+                    DGifTraceString(Private, Out, Mask, Pos, Len, CrntCode);
+                Pos += Len;
+            }
+            LastCode = CrntCode;
+        }
+    }
+
+    if (Out != Line) {
+        DGifCopyLine(Line, Out, Mask, Private->LinePos, LineLen);
+        Private->LinePos = End;
+    }
+    Private->OutPos = Pos;
+    Private->LastCode = LastCode;
 
     return GIF_OK;
 }
 
+/******************************************************************************
+ Copies Len pixels of earlier output from Src to Dst, positions are taken
+ modulo Mask + 1. Source may overlap with destination (Src + Len > Dst) only
+ when code being emitted was defined by itself, in that case pixels repeat
+ with period Dst - Src.
+******************************************************************************/
+static void
+DGifCopyString(GifByteType *Out, unsigned long Mask, unsigned long Dst,
+               unsigned long Src, unsigned long Len)
+{
+    if (Len <= 16 && Mask - (Dst & Mask) >= Len &&
+        Mask - (Src & Mask) >= Len) {
+        /* Short strings are copied pixel by pixel, which repeats period
+         * too. */
+        GifByteType *To = Out + (Dst & Mask);
+        const GifByteType *From = Out + (Src & Mask);
+        unsigned long i;
+        for (i = 0; i < Len; i++)
+            To[i] = From[i];
+        return;
+    }
+    while (Len > 0) {
+        unsigned long Chunk = Dst - Src < Len ? Dst - Src : Len;
+        /* Chunk must not wrap around the end of Out: */
+        if (Mask - (Dst & Mask) < Chunk - 1)
+            Chunk = Mask - (Dst & Mask) + 1;
+        if (Mask - (Src & Mask) < Chunk - 1)
+            Chunk = Mask - (Src & Mask) + 1;
+        memcpy(Out + (Dst & Mask), Out + (Src & Mask), Chunk);
+        Dst += Chunk;
+        Src += Chunk;
+        Len -= Chunk;
+    }
+}
+
+/******************************************************************************
+ Emits string of Code, Len pixels long, at Dst by following its prefixes
+ from the last pixel back, since its copy is no longer in History.
+******************************************************************************/
+static void
+DGifTraceString(const GifFilePrivateType *Private, GifByteType *Out,
+                unsigned long Mask, unsigned long Dst, unsigned long Len,
+                int Code)
+{
+    unsigned long i = Dst + Len;
+
+    while (Code > Private->EOFCode && i > Dst + 1) {
+        Out[--i & Mask] = Private->Suffix[Code];
+        Code = Private->Prefix[Code];
+    }
+    Out[--i & Mask] = (GifByteType)Code;
+}
+
+/******************************************************************************
+ Copies Len pixels of History from position Src to Line.
+******************************************************************************/
+static void
+DGifCopyLine(GifPixelType *Line, const GifByteType *Out, unsigned long Mask,
+             unsigned long Src, unsigned long Len)
+{
+    unsigned long First = Mask - (Src & Mask) + 1;
+
+    if (First > Len)
+        First = Len;
+    memcpy(Line, Out + (Src & Mask), First);
+    memcpy(Line + First, Out, Len - First);
+}
+#else
+
 /******************************************************************************
  The LZ decompression routine:
  This version decompress the given GIF file into Line of length LineLen.
@@ -749,14 +1227,98 @@ DGifGetPrefixChar(GifPrefixType *Prefix, int Code, int ClearCode)
     }
     return Code;
 }
+#endif /* GIF_LZW_TABLE_DECODER */
+
+/******************************************************************************
+ This routine reads all the data blocks of current image, up to the empty
+ one, into CodeBuf without their size bytes, so the decompression input
+ routine can shift in whole words instead of fetching bytes one by one.
+ CodeBuf is kept for subsequent images and only grows.
+ Memory input is not copied, its blocks are only checked to fit in memory
+ and then walked by the decompression input routine.
+ If input ends before the empty block, data read so far is still decoded and
+ the read error is reported once it runs out, so truncated image is decoded
+ as far as possible.
+******************************************************************************/
+static int
+DGifGatherCode(GifFileType *GifFile)
+{
+    GifByteType Size;
+    int Got;
+    unsigned long Len = 0;
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    Private->CodeError = 0;
+    if (Private->Mem != NULL) {
+        unsigned long Pos = Private->MemPos;
+        bool Complete = false;
+
+        while (Pos < Private->MemSize) {
+            Size = Private->Mem[Pos++];
+            if (Size == 0) {
+                Complete = true;
+                break;
+            }
+            if (Size > Private->MemSize - Pos)
+                break;
+            Pos += Size;
+        }
+        if (Complete) {
+            /* Start at size byte of first block, as if previous one ended. */
+            Private->CodePtr = Private->CodeEnd = Private->Mem + Private->MemPos;
+            Private->CodeWalk = true;
+            Private->BytesRead += Pos - Private->MemPos;
+            Private->MemPos = Pos;
+            Private->Buf[0] = 0;
+            return GIF_OK;
+        }
+        /* Truncated, blocks which are there are copied like other input. */
+    }
+
+    Private->CodeWalk = false;
+    for (;;) {
+        if (READ(GifFile, &Size, 1) != 1) {
+            Private->CodeError = D_GIF_ERR_READ_FAILED;
+            break;
+        }
+        if (Size == 0)
+            break;
+        if (Private->CodeBufSize - Len < Size) {
+            unsigned long NewSize = Private->CodeBufSize > 0 ?
+               Private->CodeBufSize * 2 : 4096;
+            GifByteType *NewBuf = realloc(Private->CodeBuf, NewSize);
+            if (NewBuf == NULL) {
+                GifFile->Error = D_GIF_ERR_NOT_ENOUGH_MEM;
+                return GIF_ERROR;
+            }
+            Private->CodeBuf = NewBuf;
+            Private->CodeBufSize = NewSize;
+        }
+        /* coverity[tainted_data] */
+        Got = READ(GifFile, Private->CodeBuf + Len, Size);
+        if (Got > 0)
+            Len += Got;
+        if (Got != Size) {
+            Private->CodeError = D_GIF_ERR_READ_FAILED;
+            break;
+        }
+    }
+    Private->Buf[0] = 0;
+    Private->CodePtr = Private->CodeBuf;
+    Private->CodeEnd = Private->CodeBuf + Len;
+
+    return GIF_OK;
+}
 
 /******************************************************************************
  The LZ decompression input routine:
  This routine is responsable for the decompression of the bit stream from
- 8 bits (bytes) packets, into the real codes.
+ the gathered data blocks into the real codes. Bits are shifted into 64 bit
+ CrntShiftDWord 8 bytes at a time, only the last 7 bytes of image data (or
+ of each data block of memory input) are shifted in one by one.
  Returns GIF_OK if read successfully.
 ******************************************************************************/
-static int
+static inline int
 DGifDecompressInput(GifFileType *GifFile, int *Code)
 {
     static const unsigned short CodeMasks[] = {
@@ -768,27 +1330,52 @@ DGifDecompressInput(GifFileType *GifFile, int *Code)
 
     GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
 
-    GifByteType NextByte;
-
     /* The image can't contain more than LZ_BITS per code. */
     if (Private->RunningBits > LZ_BITS) {
         GifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
         return GIF_ERROR;
     }
-    
-    while (Private->CrntShiftState < Private->RunningBits) {
+
+    if (Private->CrntShiftState < Private->RunningBits) {
         /* Needs to get more bytes from input stream for next code: */
-        if (DGifBufferedInput(GifFile, Private->Buf, &NextByte) == GIF_ERROR) {
-            return GIF_ERROR;
+        if (Private->CodeEnd - Private->CodePtr >= 8) {
+            uint64_t Word;
+            memcpy(&Word, Private->CodePtr, sizeof(Word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            Word = __builtin_bswap64(Word);
+#endif
+            /* Bits above new shift state are shifted in again next time. */
+            Private->CrntShiftDWord |= Word << Private->CrntShiftState;
+            Private->CodePtr += (63 - Private->CrntShiftState) >> 3;
+            Private->CrntShiftState |= 56;
+        } else {
+            do {
+                if (Private->CodePtr == Private->CodeEnd) {
+                    /* Memory input continues with next block, its size is
+                     * right after current one and was checked while
+                     * gathering. There shouldn't be any missing data here
+                     * as the LZW spec says the LZW termination code should
+                     * come first, unless input was truncated. */
+                    if (!Private->CodeWalk || *Private->CodeEnd == 0) {
+                        GifFile->Error = Private->CodeError != 0 ?
+                           Private->CodeError : D_GIF_ERR_IMAGE_DEFECT;
+                        return GIF_ERROR;
+                    }
+                    Private->CodePtr = Private->CodeEnd + 1;
+                    Private->CodeEnd = Private->CodePtr + *Private->CodeEnd;
+                    continue;
+                }
+                Private->CrntShiftDWord |=
+                   ((uint64_t)*Private->CodePtr++) << Private->CrntShiftState;
+                Private->CrntShiftState += 8;
+            } while (Private->CrntShiftState < Private->RunningBits);
         }
-        Private->CrntShiftDWord |=
-	    ((unsigned long)NextByte) << Private->CrntShiftState;
-        Private->CrntShiftState += 8;
     }
-    *Code = Private->CrntShiftDWord & CodeMasks[Private->RunningBits];
+    *Code = (int)(Private->CrntShiftDWord & CodeMasks[Private->RunningBits]);
 
     Private->CrntShiftDWord >>= Private->RunningBits;
     Private->CrntShiftState -= Private->RunningBits;
+    Private->CodeCount++;
 
     /* If code cannot fit into RunningBits bits, must raise its size. Note
      * however that codes above 4095 are used for special signaling.
@@ -803,49 +1390,3 @@ DGifDecompressInput(GifFileType *GifFile, int *Code)
     }
     return GIF_OK;
 }
-
-/******************************************************************************
- This routines read one GIF data block at a time and buffers it internally
- so that the decompression routine could access it.
- The routine returns the next byte from its internal buffer (or read next
- block in if buffer empty) and returns GIF_OK if succesful.
-******************************************************************************/
-static int
-DGifBufferedInput(GifFileType *GifFile, GifByteType *Buf, GifByteType *NextByte)
-{
-    if (Buf[0] == 0) {
-        /* Needs to read the next buffer - this one is empty: */
-        if (READ(GifFile, Buf, 1) != 1) {
-            GifFile->Error = D_GIF_ERR_READ_FAILED;
-            return GIF_ERROR;
-        }
-        /* There shouldn't be any empty data blocks here as the LZW spec
-         * says the LZW termination code should come first.  Therefore we
-         * shouldn't be inside this routine at that point.
-         */
-        if (Buf[0] == 0) {
-            GifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
-            return GIF_ERROR;
-        }
-        /* There shouldn't be any empty data blocks here as the LZW spec
-         * says the LZW termination code should come first.  Therefore we
-         * shouldn't be inside this routine at that point.
-         */
-        if (Buf[0] == 0) {
-            GifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
-            return GIF_ERROR;
-        }
-        if (READ(GifFile, &Buf[1], Buf[0]) != Buf[0]) {
-            GifFile->Error = D_GIF_ERR_READ_FAILED;
-            return GIF_ERROR;
-        }
-        *NextByte = Buf[1];
-        Buf[1] = 2;    /* We use now the second place as last char read! */
-        Buf[0]--;
-    } else {
-        *NextByte = Buf[Buf[1]++];
-        Buf[0]--;
-    }
-
-    return GIF_OK;
-}
\ No newline at end of file
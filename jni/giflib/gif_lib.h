@@ -85,6 +85,7 @@ typedef enum {
 
 /* func type to read gif data from arbitrary sources (TVT) */
 typedef int (*InputFunc) (GifFileType *, GifByteType *, int);
+typedef int (*SkipFunc) (GifFileType *, int);
 
 /******************************************************************************
  GIF89 structures
@@ -111,6 +112,14 @@ typedef struct GraphicsControlBlock {
 GifFileType *DGifOpenFileHandle(int GifFileHandle, int *Error);
 //int DGifSlurp(GifFileType * GifFile);
 GifFileType *DGifOpen(void *userPtr, InputFunc readFunc, int *Error);    /* new one (TVT) */
+GifFileType *DGifOpenMem(void *userPtr, const GifByteType *Data,
+                         unsigned long Size, int *Error);
+long DGifTellMem(GifFileType *GifFile);
+int DGifSeekMem(GifFileType *GifFile, long Pos);
+const GifByteType *DGifGetMem(GifFileType *GifFile, unsigned long *Size);
+void DGifGetCounters(GifFileType *GifFile, unsigned long *BytesRead,
+                     unsigned long *CodeCount);
+unsigned long DGifGetBufferSize(GifFileType *GifFile);
 int DGifCloseFile(GifFileType * GifFile);
 
 #define D_GIF_ERR_OPEN_FAILED    101    /* And DGif possible errors. */
@@ -131,6 +140,7 @@ int DGifCloseFile(GifFileType * GifFile);
 int DGifGetScreenDesc(GifFileType *GifFile);
 int DGifGetRecordType(GifFileType *GifFile, GifRecordType *GifType);
 int DGifGetImageDesc(GifFileType *GifFile, bool changeImageCount);
+int DGifStartImage(GifFileType *GifFile, const GifImageDesc *ImageDesc);
 int DGifGetLine(GifFileType *GifFile, GifPixelType *GifLine, int GifLineLen);
 int DGifGetExtension(GifFileType *GifFile, int *GifExtCode,
                      GifByteType **GifExtension);
@@ -138,6 +148,7 @@ int DGifGetExtensionNext(GifFileType *GifFile, GifByteType **GifExtension,int* E
 int DGifGetCode(GifFileType *GifFile, int *GifCodeSize,
                 GifByteType **GifCodeBlock);
 int DGifGetCodeNext(GifFileType *GifFile, GifByteType **GifCodeBlock);
+int DGifSkipCode(GifFileType *GifFile, SkipFunc skipFunc);
 /*****************************************************************************
  Everything below this point is new after version 1.2, supporting `slurp
  mode' for doing I/O in two big belts with all the image-bashing in core.
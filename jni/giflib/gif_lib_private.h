@@ -7,6 +7,7 @@ gif_lib_private.h - internal giflib routines and structures
 #ifndef _GIF_LIB_PRIVATE_H
 #define _GIF_LIB_PRIVATE_H
 
+#include <stdint.h>
 #include "gif_lib.h"
 
 #define EXTENSION_INTRODUCER      0x21
@@ -27,6 +28,24 @@ gif_lib_private.h - internal giflib routines and structures
 
 #define IS_READABLE(Private)    (Private->FileState & FILE_STATE_READ)
 
+/*
+ * LZW string decoder selection. By default every dictionary entry keeps the
+ * length, first pixel and output position of its string, so a code is
+ * emitted as one copy of already decoded pixels. Build with
+ * -DGIF_LZW_STACK_DECODER to trace Prefix/Suffix chains on a stack instead.
+ */
+#ifndef GIF_LZW_STACK_DECODER
+#define GIF_LZW_TABLE_DECODER
+#endif
+
+/*
+ * Images read line by line are decoded into a window of the latest output
+ * instead of a buffer of the whole image. It holds at least this many
+ * pixels, plus a line and room for two strings.
+ */
+#define HISTORY_MIN_SIZE      65536
+#define HISTORY_STRING_SLACK  (2 * (LZ_MAX_CODE + 1))
+
 typedef struct GifFilePrivateType {
     GifWord FileState, /*FileHandle,*/  /* Where all this data goes to! */
       BitsPerPixel,     /* Bits per pixel (Codes uses at least this + 1). */
@@ -39,15 +58,45 @@ typedef struct GifFilePrivateType {
 //      CrntCode,    /* Current algorithm code. */
       StackPtr,    /* For character stack (see below). */
       CrntShiftState;    /* Number of bits in CrntShiftDWord. */
-    unsigned long CrntShiftDWord;   /* For bytes decomposition into codes. */
+    uint64_t CrntShiftDWord;   /* For bytes decomposition into codes. */
     unsigned long PixelCount;   /* Number of pixels in image. */
     FILE *File;    /* File as stream. */
     InputFunc Read;     /* function to read gif input (TVT) */
+    const GifByteType *Mem;    /* Input in memory, Read is not used if set. */
+    unsigned long MemSize;
+    unsigned long MemPos;
+    unsigned long BytesRead;    /* Input consumed so far, skipped data */
+    unsigned long CodeCount;    /* excluded, and LZW codes decoded. */
 //    OutputFunc Write;   /* function to write gif output (MRB) */
     GifByteType Buf[256];   /* Compressed input is buffered here. */
+    GifByteType *CodeBuf;  /* Data blocks of current image, without... */
+    unsigned long CodeBufSize;  /* ...block sizes, gathered for decoding. */
+    const GifByteType *CodePtr; /* Next byte to shift in, NULL if image */
+    const GifByteType *CodeEnd; /* data was not gathered yet. Data blocks */
+                                /* of Mem are not gathered, but walked. */
+    bool CodeWalk;              /* CodePtr walks data blocks of Mem. */
+    int CodeError;              /* Reported when gathered data runs out, */
+                                /* 0 if input was not truncated. */
+#ifdef GIF_LZW_TABLE_DECODER
+    GifByteType *Out;      /* Pixels of current image decoded so far... */
+    unsigned long OutMask; /* ...at position & OutMask. */
+    unsigned long OutPos;  /* Number of pixels decoded. */
+    unsigned long LinePos; /* Number of pixels returned, if read in pieces. */
+    GifByteType *History;  /* Owned Out, window of latest output if image */
+    unsigned long HistorySize;  /* is read in pieces. */
+    unsigned long LastPos; /* Output position of LastCode string. */
+    unsigned long LastLen; /* Length of LastCode string. */
+    uint32_t StringPos[LZ_MAX_CODE + 1];  /* Codes as strings in Out, images */
+                                          /* are below 2^32 pixels. */
+    unsigned short StringLen[LZ_MAX_CODE + 1];  /* 0 if code not defined. */
+    GifByteType StringFirst[LZ_MAX_CODE + 1];
+    GifByteType Suffix[LZ_MAX_CODE + 1];    /* Strings no longer in */
+    GifPrefixType Prefix[LZ_MAX_CODE + 1];  /* History are traced. */
+#else
     GifByteType Stack[LZ_MAX_CODE]; /* Decoded pixels are stacked here. */
     GifByteType Suffix[LZ_MAX_CODE + 1];    /* So we can trace the codes. */
     GifPrefixType Prefix[LZ_MAX_CODE + 1];
+#endif
 //    bool gif89;
 } GifFilePrivateType;
 
@@ -64,7 +64,7 @@ public class GifAnimationMetaData implements Serializable, Parcelable {
     public GifAnimationMetaData(String filePath) throws IOException {
         if (filePath == null)
             throw new NullPointerException("Source is null");
-        init(GifDrawable.openFile(mMetaData, filePath, true));
+        init(GifDrawable.openFile(mMetaData, filePath, true, 1));
     }
 
     /**
@@ -77,7 +77,7 @@ public class GifAnimationMetaData implements Serializable, Parcelable {
     public GifAnimationMetaData(File file) throws IOException {
         if (file == null)
             throw new NullPointerException("Source is null");
-        init(GifDrawable.openFile(mMetaData, file.getPath(), true));
+        init(GifDrawable.openFile(mMetaData, file.getPath(), true, 1));
     }
 
     /**
@@ -94,7 +94,7 @@ public class GifAnimationMetaData implements Serializable, Parcelable {
             throw new NullPointerException("Source is null");
         if (!stream.markSupported())
             throw new IllegalArgumentException("InputStream does not support marking");
-        init(GifDrawable.openStream(mMetaData, stream, true));
+        init(GifDrawable.openStream(mMetaData, stream, true, 1));
     }
 
     /**
@@ -110,7 +110,7 @@ public class GifAnimationMetaData implements Serializable, Parcelable {
             throw new NullPointerException("Source is null");
         FileDescriptor fd = afd.getFileDescriptor();
         try {
-            init(GifDrawable.openFd(mMetaData, fd, afd.getStartOffset(), true));
+            init(GifDrawable.openFd(mMetaData, fd, afd.getStartOffset(), true, 1));
         } catch (IOException ex) {
             afd.close();
             throw ex;
@@ -127,7 +127,7 @@ public class GifAnimationMetaData implements Serializable, Parcelable {
     public GifAnimationMetaData(FileDescriptor fd) throws IOException {
         if (fd == null)
             throw new NullPointerException("Source is null");
-        init(GifDrawable.openFd(mMetaData, fd, 0, true));
+        init(GifDrawable.openFd(mMetaData, fd, 0, true, 1));
     }
 
     /**
@@ -141,7 +141,7 @@ public class GifAnimationMetaData implements Serializable, Parcelable {
     public GifAnimationMetaData(byte[] bytes) throws IOException {
         if (bytes == null)
             throw new NullPointerException("Source is null");
-        init(GifDrawable.openByteArray(mMetaData, bytes, true));
+        init(GifDrawable.openByteArray(mMetaData, bytes, true, 1));
     }
 
     /**
@@ -158,7 +158,7 @@ public class GifAnimationMetaData implements Serializable, Parcelable {
             throw new NullPointerException("Source is null");
         if (!buffer.isDirect())
             throw new IllegalArgumentException("ByteBuffer is not direct");
-        init(GifDrawable.openDirectByteBuffer(mMetaData, buffer, true));
+        init(GifDrawable.openDirectByteBuffer(mMetaData, buffer, true, 1));
     }
 
     /**
@@ -23,6 +23,8 @@ import java.io.FileDescriptor;
 import java.io.IOException;
 import java.io.InputStream;
 import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.IntBuffer;
 import java.util.Locale;
 import java.util.concurrent.ConcurrentLinkedQueue;
 
@@ -47,15 +49,26 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
      */
     private static native boolean renderFrame(int[] pixels, long gifFileInPtr, int[] metaData);
 
-    static native long openFd(int[] metaData, FileDescriptor fd, long offset, boolean justDecodeMetaData) throws GifIOException;
+    /**
+     * Like {@link #renderFrame(int[], long, int[])} but uses buffers registered by
+     * {@link #setFrameBuffer(long, ByteBuffer, ByteBuffer)}.
+     *
+     * @param gifFileInPtr GifInfo pointer
+     * @return true if loop of the animation is completed
+     */
+    private static native boolean renderFrameToBuffer(long gifFileInPtr);
 
-    static native long openByteArray(int[] metaData, byte[] bytes, boolean justDecodeMetaData) throws GifIOException;
+    private static native boolean setFrameBuffer(long gifFileInPtr, ByteBuffer pixels, ByteBuffer metaData);
 
-    static native long openDirectByteBuffer(int[] metaData, ByteBuffer buffer, boolean justDecodeMetaData) throws GifIOException;
+    static native long openFd(int[] metaData, FileDescriptor fd, long offset, boolean justDecodeMetaData, int sampleSize) throws GifIOException;
 
-    static native long openStream(int[] metaData, InputStream stream, boolean justDecodeMetaData) throws GifIOException;
+    static native long openByteArray(int[] metaData, byte[] bytes, boolean justDecodeMetaData, int sampleSize) throws GifIOException;
 
-    static native long openFile(int[] metaData, String filePath, boolean justDecodeMetaData) throws GifIOException;
+    static native long openDirectByteBuffer(int[] metaData, ByteBuffer buffer, boolean justDecodeMetaData, int sampleSize) throws GifIOException;
+
+    static native long openStream(int[] metaData, InputStream stream, boolean justDecodeMetaData, int sampleSize) throws GifIOException;
+
+    static native long openFile(int[] metaData, String filePath, boolean justDecodeMetaData, int sampleSize) throws GifIOException;
 
     static native void free(long gifFileInPtr);
 
@@ -81,10 +94,52 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
 
     private static native long getAllocationByteCount(long gifFileInPtr);
 
+    private static native boolean setSeekCheckpoints(long gifFileInPtr, int frameInterval, long maxBytes);
+
+    private static native boolean setReplayCache(long gifFileInPtr, long maxBytes);
+
+    private static native boolean setDecodeAhead(long gifFileInPtr, boolean enabled);
+
+    private static native void setDecodePriority(long gifFileInPtr, int priority);
+
+    private static native boolean isNextFrameDecoded(long gifFileInPtr);
+
+    private static native void getStats(long gifFileInPtr, long[] stats);
+
+    private static native void setTracing(boolean enabled);
+
+    private static native boolean flushTrace(String path);
+
+    private static native void setFramePolicy(long gifFileInPtr, int policy);
+
+    /**
+     * Next frame is due its duration after the current one is drawn, so late frames delay all further ones.
+     * This is the default policy.
+     */
+    public static final int FRAME_POLICY_DELAY = 0;
+    /**
+     * Frames are due at fixed intervals, frames following a late one are drawn sooner until animation is back on time.
+     */
+    public static final int FRAME_POLICY_DRIFT_FREE = 1;
+    /**
+     * Like {@link #FRAME_POLICY_DRIFT_FREE} but frames whose whole duration has already passed are composited
+     * without being shown, or not decoded at all if the next frame completely covers them.
+     */
+    public static final int FRAME_POLICY_CATCH_UP = 2;
+
+    private static final int DECODE_PRIORITY_VISIBLE = 0;
+    private static final int DECODE_PRIORITY_BACKGROUND = 1;
+    private static final int DECODE_PRIORITY_PAUSED = 2;
+
+    private static final int STATS_LENGTH = 24;
+
     private volatile long mGifInfoPtr;
     private volatile boolean mIsRunning = true;
+    private volatile boolean mCanSeekBackward;
+    private volatile ByteBuffer mFrameBuffer;//registered by setFrameBuffer, null if frames are rendered to mColors
+    private volatile boolean mIsDecodingAhead;
 
-    private final int[] mMetaData = new int[5];//[w,h,imageCount,errorCode,post invalidation time]
+    private final int[] mMetaData = new int[10];//[w,h,imageCount,errorCode,post invalidation time,dirty left,top,right,bottom,decoded ahead]
     private final long mInputSourceLength;
 
     private float mSx = 1f;
@@ -114,6 +169,7 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
         @Override
         public void run() {
             restoreRemainder(mGifInfoPtr);
+            updateDecodePriority();
             invalidateSelf();
         }
     };
@@ -122,6 +178,7 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
         @Override
         public void run() {
             saveRemainder(mGifInfoPtr);
+            updateDecodePriority();
         }
     };
 
@@ -172,10 +229,23 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
      * @throws NullPointerException if filePath is null
      */
     public GifDrawable(String filePath) throws IOException {
+        this(filePath, 1);
+    }
+
+    /**
+     * Like {@link #GifDrawable(String)} but subsampled, eg. for thumbnails. Only every {@code sampleSize}-th
+     * pixel of every {@code sampleSize}-th row is kept, so canvas and intrinsic dimensions are divided
+     * by {@code sampleSize}, rounded up.
+     *
+     * @param filePath see {@link #GifDrawable(String)}
+     * @param sampleSize subsampling factor, eg. 2, 4 or 8; values below 2 disable subsampling
+     * @throws IOException when opening failed
+     */
+    public GifDrawable(String filePath, int sampleSize) throws IOException {
         if (filePath == null)
             throw new NullPointerException("Source is null");
         mInputSourceLength = new File(filePath).length();
-        mGifInfoPtr = openFile(mMetaData, filePath, false);
+        mGifInfoPtr = openFile(mMetaData, filePath, false, sampleSize);
         mColors = new int[mMetaData[0] * mMetaData[1]];
     }
 
@@ -187,16 +257,29 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
      * @throws NullPointerException if file is null
      */
     public GifDrawable(File file) throws IOException {
+        this(file, 1);
+    }
+
+    /**
+     * Like {@link #GifDrawable(File)} but subsampled, see {@link #GifDrawable(String, int)}.
+     *
+     * @param file source
+     * @param sampleSize subsampling factor
+     * @throws IOException when opening failed
+     */
+    public GifDrawable(File file, int sampleSize) throws IOException {
         if (file == null)
             throw new NullPointerException("Source is null");
         mInputSourceLength = file.length();
-        mGifInfoPtr = openFile(mMetaData, file.getPath(), false);
+        mGifInfoPtr = openFile(mMetaData, file.getPath(), false, sampleSize);
         mColors = new int[mMetaData[0] * mMetaData[1]];
     }
 
     /**
      * Creates drawable from InputStream.
      * InputStream must support marking, IllegalArgumentException will be thrown otherwise.
+     * Stream is read in large chunks. Streams up to 8 MiB are kept in native memory once read,
+     * larger ones are reset and read again on each loop.
      *
      * @param stream stream to read from
      * @throws IOException              when opening failed
@@ -204,11 +287,22 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
      * @throws NullPointerException     if stream is null
      */
     public GifDrawable(InputStream stream) throws IOException {
+        this(stream, 1);
+    }
+
+    /**
+     * Like {@link #GifDrawable(InputStream)} but subsampled, see {@link #GifDrawable(String, int)}.
+     *
+     * @param stream source
+     * @param sampleSize subsampling factor
+     * @throws IOException when opening failed
+     */
+    public GifDrawable(InputStream stream, int sampleSize) throws IOException {
         if (stream == null)
             throw new NullPointerException("Source is null");
         if (!stream.markSupported())
             throw new IllegalArgumentException("InputStream does not support marking");
-        mGifInfoPtr = openStream(mMetaData, stream, false);
+        mGifInfoPtr = openStream(mMetaData, stream, false, sampleSize);
         mColors = new int[mMetaData[0] * mMetaData[1]];
         mInputSourceLength = -1L;
     }
@@ -222,11 +316,22 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
      * @throws IOException          when opening failed
      */
     public GifDrawable(AssetFileDescriptor afd) throws IOException {
+        this(afd, 1);
+    }
+
+    /**
+     * Like {@link #GifDrawable(AssetFileDescriptor)} but subsampled, see {@link #GifDrawable(String, int)}.
+     *
+     * @param afd source
+     * @param sampleSize subsampling factor
+     * @throws IOException when opening failed
+     */
+    public GifDrawable(AssetFileDescriptor afd, int sampleSize) throws IOException {
         if (afd == null)
             throw new NullPointerException("Source is null");
         FileDescriptor fd = afd.getFileDescriptor();
         try {
-            mGifInfoPtr = openFd(mMetaData, fd, afd.getStartOffset(), false);
+            mGifInfoPtr = openFd(mMetaData, fd, afd.getStartOffset(), false, sampleSize);
         } catch (IOException ex) {
             afd.close();
             throw ex;
@@ -243,9 +348,20 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
      * @throws NullPointerException if fd is null
      */
     public GifDrawable(FileDescriptor fd) throws IOException {
+        this(fd, 1);
+    }
+
+    /**
+     * Like {@link #GifDrawable(FileDescriptor)} but subsampled, see {@link #GifDrawable(String, int)}.
+     *
+     * @param fd source
+     * @param sampleSize subsampling factor
+     * @throws IOException when opening failed
+     */
+    public GifDrawable(FileDescriptor fd, int sampleSize) throws IOException {
         if (fd == null)
             throw new NullPointerException("Source is null");
-        mGifInfoPtr = openFd(mMetaData, fd, 0, false);
+        mGifInfoPtr = openFd(mMetaData, fd, 0, false, sampleSize);
         mColors = new int[mMetaData[0] * mMetaData[1]];
         mInputSourceLength = -1L;
     }
@@ -259,9 +375,20 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
      * @throws NullPointerException if bytes are null
      */
     public GifDrawable(byte[] bytes) throws IOException {
+        this(bytes, 1);
+    }
+
+    /**
+     * Like {@link #GifDrawable(byte[])} but subsampled, see {@link #GifDrawable(String, int)}.
+     *
+     * @param bytes source
+     * @param sampleSize subsampling factor
+     * @throws IOException when opening failed
+     */
+    public GifDrawable(byte[] bytes, int sampleSize) throws IOException {
         if (bytes == null)
             throw new NullPointerException("Source is null");
-        mGifInfoPtr = openByteArray(mMetaData, bytes, false);
+        mGifInfoPtr = openByteArray(mMetaData, bytes, false, sampleSize);
         mColors = new int[mMetaData[0] * mMetaData[1]];
         mInputSourceLength = bytes.length;
     }
@@ -276,11 +403,22 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
      * @throws NullPointerException     if buffer is null
      */
     public GifDrawable(ByteBuffer buffer) throws IOException {
+        this(buffer, 1);
+    }
+
+    /**
+     * Like {@link #GifDrawable(ByteBuffer)} but subsampled, see {@link #GifDrawable(String, int)}.
+     *
+     * @param buffer source
+     * @param sampleSize subsampling factor
+     * @throws IOException when opening failed
+     */
+    public GifDrawable(ByteBuffer buffer, int sampleSize) throws IOException {
         if (buffer == null)
             throw new NullPointerException("Source is null");
         if (!buffer.isDirect())
             throw new IllegalArgumentException("ByteBuffer is not direct");
-        mGifInfoPtr = openDirectByteBuffer(mMetaData, buffer, false);
+        mGifInfoPtr = openDirectByteBuffer(mMetaData, buffer, false, sampleSize);
         mColors = new int[mMetaData[0] * mMetaData[1]];
         mInputSourceLength = buffer.capacity();
     }
@@ -310,6 +448,7 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
         long tmpPtr = mGifInfoPtr;
         mGifInfoPtr = 0L;
         mColors = null;
+        mFrameBuffer = null;
         free(tmpPtr);
     }
 
@@ -430,6 +569,28 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
         return GifError.fromCode(mMetaData[3]);
     }
 
+    /**
+     * Starts or stops recording begin and end of native decoding stages of all GifDrawables,
+     * eg. LZW decoding, disposal and rewinding, on all threads.
+     * Library has to be built with GIF_TRACE defined, nothing is recorded otherwise.
+     *
+     * @param enabled whether stages should be recorded
+     */
+    public static void setTracingEnabled(boolean enabled) {
+        setTracing(enabled);
+    }
+
+    /**
+     * Appends stages recorded since the previous call to a file in Chrome trace event JSON format,
+     * which can be opened in chrome://tracing or Perfetto. Each thread keeps only the latest 8192 events.
+     *
+     * @param path path of the file, it is created if it does not exist
+     * @return true on success, false if file cannot be written or tracing is not built in
+     */
+    public static boolean writeTrace(String path) {
+        return flushTrace(path);
+    }
+
     /**
      * An {@link GifDrawable#GifDrawable(Resources, int)} wrapper but returns null
      * instead of throwing exception if creation fails.
@@ -462,6 +623,19 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
         setSpeedFactor(mGifInfoPtr, factor);
     }
 
+    /**
+     * Sets how frames are scheduled when they are drawn later than they were due.
+     * With drift free and catch up policies animation more than a second behind is rescheduled from the current time.
+     *
+     * @param policy one of {@link #FRAME_POLICY_DELAY}, {@link #FRAME_POLICY_DRIFT_FREE}, {@link #FRAME_POLICY_CATCH_UP}
+     * @throws IllegalArgumentException if policy is not one of them
+     */
+    public void setFramePolicy(int policy) {
+        if (policy < FRAME_POLICY_DELAY || policy > FRAME_POLICY_CATCH_UP)
+            throw new IllegalArgumentException("Unknown frame policy " + policy);
+        setFramePolicy(mGifInfoPtr, policy);
+    }
+
     /**
      * Equivalent of {@link #stop()}
      */
@@ -496,11 +670,11 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
 
     /**
      * Seeks animation to given absolute position (within given loop) and refreshes the canvas.<br>
-     * <b>NOTE: only seeking forward is supported.</b><br>
+     * <b>NOTE: only seeking forward is supported unless {@link #setSeekCheckpoints(int, long)} is used.</b><br>
      * If position is less than current position or GIF has only one frame then nothing happens.
      * If position is greater than duration of the loop of animation
      * (or whole animation if there is no loop) then animation will be sought to the end.<br>
-     * NOTE: all frames from current to desired must be rendered sequentially to perform seeking.
+     * NOTE: all frames from current (or nearest checkpoint) to desired must be rendered sequentially to perform seeking.
      * It may take a lot of time if number of such frames is large.
      * This method can be called from any thread but actual work will be performed on UI thread.
      *
@@ -514,7 +688,7 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
         runOnUiThread(new Runnable() {
             @Override
             public void run() {
-                seekToTime(mGifInfoPtr, position, mColors);
+                seekToTime(mGifInfoPtr, position, mFrameBuffer != null ? null : mColors);
                 invalidateSelf();
             }
         });
@@ -532,12 +706,186 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
         runOnUiThread(new Runnable() {
             @Override
             public void run() {
-                seekToFrame(mGifInfoPtr, frameIndex, mColors);
+                seekToFrame(mGifInfoPtr, frameIndex, mFrameBuffer != null ? null : mColors);
                 invalidateSelf();
             }
         });
     }
 
+    /**
+     * Enables backward seeking and shortens forward one by keeping copies of the canvas
+     * (checkpoints) every <code>frameInterval</code> frames, captured as frames are rendered.
+     * If they do not fit in <code>maxBytes</code> they are spaced further apart.
+     * Seeking then renders frames starting from the nearest checkpoint before desired one.
+     * This method can be called from any thread but actual work will be performed on UI thread,
+     * use {@link #canSeekBackward()} afterwards to check whether checkpoints are enabled.
+     *
+     * @param frameInterval number of frames between checkpoints, 0 disables checkpoints
+     * @param maxBytes      upper limit of memory used by checkpoints
+     * @throws IllegalArgumentException if frameInterval&lt;0
+     */
+    public void setSeekCheckpoints(final int frameInterval, final long maxBytes) {
+        if (frameInterval < 0)
+            throw new IllegalArgumentException("frameInterval is negative");
+        runOnUiThread(new Runnable() {
+            @Override
+            public void run() {
+                mCanSeekBackward = setSeekCheckpoints(mGifInfoPtr, frameInterval, maxBytes);
+            }
+        });
+    }
+
+    /**
+     * Enables keeping rendered frames (only areas changed since previous frame) in memory during
+     * the first loop of the animation. If all of them fit in <code>maxBytes</code> subsequent loops
+     * are replayed from memory without decoding, otherwise kept frames are released and decoding continues.
+     * This method can be called from any thread but actual work will be performed on UI thread.
+     *
+     * @param maxBytes upper limit of memory used by kept frames, 0 disables replaying
+     * @throws IllegalArgumentException if maxBytes&lt;0
+     */
+    public void setReplayCacheBudget(final long maxBytes) {
+        if (maxBytes < 0)
+            throw new IllegalArgumentException("maxBytes is negative");
+        runOnUiThread(new Runnable() {
+            @Override
+            public void run() {
+                setReplayCache(mGifInfoPtr, maxBytes);
+            }
+        });
+    }
+
+    /**
+     * Registers direct buffers to which frames are rendered by {@link #renderFrameToBuffer()},
+     * their addresses are resolved once here so no pixels are copied between Java and native
+     * heap while rendering. Sought frames are also rendered there once buffers are registered.
+     * <code>pixels</code> receives the frame as packed ints in native byte order, like {@link #getPixels(int[])},
+     * it must hold at least {@link #getFrameByteCount()} bytes.
+     * <code>metaData</code> must hold at least 40 bytes and is filled with ints in native byte order:
+     * width, height, number of frames, error code, milliseconds until next frame is due (-1 if it is already due),
+     * area changed by the last frame as left, top, right, bottom (see {@link #getDirtyRect(Rect)})
+     * and 1 if the last frame had been decoded ahead in time (see {@link #isDecodeAheadKeepingUp()}), 0 otherwise.
+     * While buffers are registered they hold the canvas of the animation: {@link #draw(Canvas)} does not advance it
+     * and keeps drawing the frame rendered before registration, which {@link #getPixels(int[])} and
+     * {@link #getPixel(int, int)} return too.
+     * Current frame is copied to <code>pixels</code> when it is registered and back when buffers are unregistered,
+     * so animation continues from the same frame either way.
+     * This method and {@link #renderFrameToBuffer()} should be called on the same thread.
+     *
+     * @param pixels   direct buffer receiving frames, null unregisters buffers
+     * @param metaData direct buffer receiving metadata, null unregisters buffers
+     * @return true if buffers were registered
+     */
+    public boolean setFrameBuffer(ByteBuffer pixels, ByteBuffer metaData) {
+        final int[] colors = mColors;
+        final ByteBuffer previous = mFrameBuffer;
+        if (previous != null && colors != null)
+            asPixels(previous).get(colors);
+        final boolean isRegistered = setFrameBuffer(mGifInfoPtr, pixels, metaData);
+        if (isRegistered && colors != null)
+            asPixels(pixels).put(colors);
+        mFrameBuffer = isRegistered ? pixels : null;
+        return isRegistered;
+    }
+
+    private static IntBuffer asPixels(ByteBuffer buffer) {
+        final ByteBuffer pixels = buffer.duplicate();
+        pixels.clear();
+        return pixels.order(ByteOrder.nativeOrder()).asIntBuffer();
+    }
+
+    /**
+     * Renders next frame into buffers registered by {@link #setFrameBuffer(ByteBuffer, ByteBuffer)}
+     * if it is due. Time until next frame is then available in metadata buffer.
+     *
+     * @return true if loop of the animation is completed, false also if no buffers are registered
+     */
+    public boolean renderFrameToBuffer() {
+        if (!mIsRunning)
+            return false;
+        final boolean isAnimationCompleted = renderFrameToBuffer(mGifInfoPtr);
+        if (isAnimationCompleted)
+            for (AnimationListener listener : mListeners)
+                listener.onAnimationCompleted();
+        return isAnimationCompleted;
+    }
+
+    /**
+     * Enables decoding of the next frame on a background thread while current one is shown.
+     * Frame is then only composited when it is due, so time spent by {@link #draw(Canvas)} on decoding is hidden
+     * unless decoding takes longer than frame duration. Frames of all drawables are decoded by a small process-wide
+     * pool of threads, earliest deadline first. Drawables which are not visible are served after visible ones
+     * and stopped ones are not decoded at all. It costs width * height bytes per drawable.
+     * Decoding ahead is supported only for files, file descriptors, byte arrays and direct {@link ByteBuffer}s
+     * having at least 2 frames.
+     * This method can be called from any thread but actual work will be performed on UI thread,
+     * use {@link #isDecodingAhead()} afterwards to check whether decoding ahead is enabled.
+     *
+     * @param enabled true to decode frames ahead, false to decode them when they are due
+     */
+    public void setDecodeAhead(final boolean enabled) {
+        runOnUiThread(new Runnable() {
+            @Override
+            public void run() {
+                mIsDecodingAhead = setDecodeAhead(mGifInfoPtr, enabled);
+                updateDecodePriority();
+            }
+        });
+    }
+
+    private void updateDecodePriority() {
+        if (!mIsDecodingAhead)
+            return;
+        if (!mIsRunning)
+            setDecodePriority(mGifInfoPtr, DECODE_PRIORITY_PAUSED);
+        else
+            setDecodePriority(mGifInfoPtr, isVisible() ? DECODE_PRIORITY_VISIBLE : DECODE_PRIORITY_BACKGROUND);
+    }
+
+    /**
+     * Besides changing visibility, lowers priority of decoding ahead while drawable is not visible,
+     * so visible animations sharing the decoding threads are served first.
+     *
+     * @param visible true if drawable is now visible
+     * @param restart see {@link Drawable#setVisible(boolean, boolean)}
+     * @return true if visibility changed
+     */
+    @Override
+    public boolean setVisible(boolean visible, boolean restart) {
+        final boolean changed = super.setVisible(visible, restart);
+        updateDecodePriority();
+        return changed;
+    }
+
+    /**
+     * Checks whether the frame following the current one has already been decoded in the background,
+     * so drawing it when it is due will not wait for decoding.
+     *
+     * @return true if next frame is ready, false if it is not or decoding ahead is disabled
+     */
+    public boolean isNextFrameDecoded() {
+        return isNextFrameDecoded(mGifInfoPtr);
+    }
+
+    /**
+     * Checks whether frames are decoded ahead on a background thread.
+     *
+     * @return true if decoding ahead was enabled by {@link #setDecodeAhead(boolean)}
+     */
+    public boolean isDecodingAhead() {
+        return mIsDecodingAhead;
+    }
+
+    /**
+     * Checks whether frame rendered during the last {@link #draw(Canvas)} had been decoded on a background thread
+     * before it was due. If not, drawing waited for decoding or the frame was decoded synchronously, eg. after seeking.
+     *
+     * @return true if decoding ahead kept up with the animation
+     */
+    public boolean isDecodeAheadKeepingUp() {
+        return mMetaData[9] != 0;
+    }
+
     /**
      * Equivalent of {@link #isRunning()}
      *
@@ -571,13 +919,13 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
 
     /**
      * Checks whether seeking backward can be performed.
-     * Due to different frame disposal methods it is not supported now.
+     * Due to different frame disposal methods it is supported only if checkpoints are enabled.
      *
-     * @return always false
+     * @return true if checkpoints were enabled by {@link #setSeekCheckpoints(int, long)}
      */
     @Override
     public boolean canSeekBackward() {
-        return false;
+        return mCanSeekBackward;
     }
 
     /**
@@ -611,9 +959,35 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
         return mMetaData[0] * mMetaData[1] * 4;
     }
 
+    /**
+     * Returns native performance counters accumulated since this drawable was opened.
+     * Elements of the returned array are in order:
+     * <ol start="0">
+     * <li>number of frames rendered</li>
+     * <li>number of frames rendered 20 ms or more after they were due</li>
+     * <li>number of times input was rewound</li>
+     * <li>number of input bytes read, by all decoding threads</li>
+     * <li>number of LZW codes decoded, by all decoding threads</li>
+     * <li>total time spent decoding and compositing rendered frames, in microseconds</li>
+     * <li>16 histogram buckets of that time per frame, bucket <code>i</code> counting frames
+     * which took from 2<sup>i</sup> to 2<sup>i+1</sup> microseconds, the last one also counting any slower frames</li>
+     * <li>number of frames composited without being shown while catching up, see {@link #FRAME_POLICY_CATCH_UP}</li>
+     * <li>number of frames not decoded at all while catching up</li>
+     * </ol>
+     *
+     * @return counters, all zero if drawable is recycled
+     */
+    public long[] getStats() {
+        final long[] stats = new long[STATS_LENGTH];
+        getStats(mGifInfoPtr, stats);
+        return stats;
+    }
+
     /**
      * Returns size of the allocated memory used to store pixels of this object.
-     * It counts length of all frame buffers. Returned value does not change during runtime.
+     * It counts length of all frame buffers and buffers of native decoders, including ones decoding
+     * frames ahead or in parallel. Decoder buffers grow with the largest frame decoded so far, so
+     * returned value may increase until all frames have been shown once.
      *
      * @return size of the allocated memory used to store pixels of this object
      */
@@ -637,6 +1011,22 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
         return mInputSourceLength;
     }
 
+    /**
+     * Retrieves area of the frame buffer changed by the frame rendered during the last {@link #draw(Canvas)},
+     * in frame buffer coordinates, ie. canvas of {@link #getIntrinsicWidth()} by {@link #getIntrinsicHeight()}
+     * pixels. If drawable is subsampled, canvas pixel (x, y) comes from GIF screen pixel
+     * (x * sampleSize, y * sampleSize), so the area is the changed part of the GIF screen divided by
+     * {@code sampleSize}. It is the whole canvas for the first frame of each loop.
+     * Pixels outside this area are the same as before that frame was rendered.
+     *
+     * @param outRect rect to receive the area, set empty if no frame was rendered
+     * @return false if no frame was rendered
+     */
+    public boolean getDirtyRect(Rect outRect) {
+        outRect.set(mMetaData[5], mMetaData[6], mMetaData[7], mMetaData[8]);
+        return !outRect.isEmpty();
+    }
+
     /**
      * Returns in pixels[] a copy of the data in the current frame. Each value is a packed int representing a {@link Color}.
      * If GifDrawable is recycled pixels[] is left unchanged.
@@ -686,6 +1076,8 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
 
     /**
      * Reads and renders new frame if needed then draws last rendered frame.
+     * If buffers are registered by {@link #setFrameBuffer(ByteBuffer, ByteBuffer)} no frame is rendered,
+     * they are advanced by {@link #renderFrameToBuffer()} only.
      *
      * @param canvas canvas to draw into
      */
@@ -698,7 +1090,7 @@ public class GifDrawable extends Drawable implements Animatable, MediaPlayerCont
             mApplyTransformation = false;
         }
         if (mPaint.getShader() == null) {
-            if (mIsRunning) {
+            if (mIsRunning && mFrameBuffer == null) {
                 if (renderFrame(mColors, mGifInfoPtr, mMetaData))
                     for (AnimationListener listener : mListeners)
                         listener.onAnimationCompleted();
@@ -0,0 +1,176 @@
+/**
+ * Checks that area of a frame disposed to previous is restored whatever
+ * disposal method the following frame has.
+ * Frames: opaque background covering whole screen, small frame disposed to
+ * previous, then a frame elsewhere not covering it. Once the last one is
+ * drawn, area of the middle frame has to match the background again.
+ */
+#include "gif.h"
+
+#define SCREEN_SIZE 8
+#define COLOR_BITS 2
+
+typedef struct
+{
+	GifByteType data[1024];
+	size_t length;
+} GifWriter;
+
+static void putByte(GifWriter* w, GifByteType b)
+{
+	w->data[w->length++] = b;
+}
+
+static void putWord(GifWriter* w, GifWord v)
+{
+	putByte(w, (GifByteType) (v & 0xFF));
+	putByte(w, (GifByteType) (v >> 8));
+}
+
+static void putCode(GifWriter* w, uint32_t* bits, int* bitCount, int code)
+{
+	*bits |= (uint32_t) code << *bitCount;
+	for (*bitCount += COLOR_BITS + 1; *bitCount >= 8; *bitCount -= 8)
+	{
+		putByte(w, (GifByteType) (*bits & 0xFF));
+		*bits >>= 8;
+	}
+}
+
+/**
+ * Writes image data as a single sub-block, emitting clear code before each
+ * pixel so that code size never grows and no LZW encoder is needed.
+ */
+static void putPixels(GifWriter* w, GifByteType index, int count)
+{
+	const int clearCode = 1 << COLOR_BITS;
+	uint32_t bits = 0;
+	int bitCount = 0;
+	int i;
+	putByte(w, COLOR_BITS);
+	const size_t sizePos = w->length;
+	putByte(w, 0);
+	for (i = 0; i < count; i++)
+	{
+		putCode(w, &bits, &bitCount, clearCode);
+		putCode(w, &bits, &bitCount, index);
+	}
+	putCode(w, &bits, &bitCount, clearCode + 1);
+	if (bitCount > 0)
+		putByte(w, (GifByteType) bits);
+	w->data[sizePos] = (GifByteType) (w->length - sizePos - 1);
+	putByte(w, 0);
+}
+
+static void putFrame(GifWriter* w, int disposal, GifWord left, GifWord top,
+		GifWord width, GifWord height, GifByteType index)
+{
+	putByte(w, '!');
+	putByte(w, GRAPHICS_EXT_FUNC_CODE);
+	putByte(w, 4);
+	putByte(w, (GifByteType) (disposal << 2));
+	putWord(w, 10);
+	putByte(w, 0);
+	putByte(w, 0);
+	putByte(w, ',');
+	putWord(w, left);
+	putWord(w, top);
+	putWord(w, width);
+	putWord(w, height);
+	putByte(w, 0);
+	putPixels(w, index, width * height);
+}
+
+static void writeGif(GifWriter* w, int lastDisposal)
+{
+	static const GifByteType netscape[] = { 0x21, 0xFF, 0x0B, 'N', 'E', 'T',
+			'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00 };
+	int i;
+	memcpy(w->data, "GIF89a", 6);
+	w->length = 6;
+	putWord(w, SCREEN_SIZE);
+	putWord(w, SCREEN_SIZE);
+	putByte(w, 0x80 | 0x70 | (COLOR_BITS - 1));
+	putByte(w, 0);
+	putByte(w, 0);
+	for (i = 0; i < 1 << COLOR_BITS; i++)
+	{
+		putByte(w, (GifByteType) (i * 80));
+		putByte(w, (GifByteType) (255 - i * 80));
+		putByte(w, (GifByteType) (i * 40));
+	}
+	memcpy(w->data + w->length, netscape, sizeof(netscape));
+	w->length += sizeof(netscape);
+	putFrame(w, DISPOSE_DO_NOT, 0, 0, SCREEN_SIZE, SCREEN_SIZE, 0);
+	putFrame(w, DISPOSE_PREVIOUS, 2, 3, 4, 3, 1);
+	putFrame(w, lastDisposal, 0, 0, 2, 2, 2);
+	putByte(w, ';');
+}
+
+static bool isInRect(int x, int y, int left, int top, int width, int height)
+{
+	return x >= left && x < left + width && y >= top && y < top + height;
+}
+
+/**
+ * @return number of pixels differing from expected ones after each frame
+ */
+static int checkSequence(int lastDisposal)
+{
+	GifWriter w;
+	writeGif(&w, lastDisposal);
+	RenderMetaData meta;
+	GifInfo* info = openGifMemory(w.data, w.length, false, 1, &meta);
+	if (info == NULL)
+	{
+		printf("open failed, error %d\n", meta.errorCode);
+		return -1;
+	}
+	const int pxCount = SCREEN_SIZE * SCREEN_SIZE;
+	argb pixels[SCREEN_SIZE * SCREEN_SIZE];
+	argb background[SCREEN_SIZE * SCREEN_SIZE];
+	int bad = 0;
+	int frame;
+	for (frame = 0; frame < 3; frame++)
+	{
+		renderGifFrame(info, pixels, frame * 1000, &meta);
+		if (meta.errorCode != 0)
+		{
+			printf("frame %d: error %d\n", frame, meta.errorCode);
+			bad++;
+		}
+		if (frame == 0)
+			memcpy(background, pixels, sizeof(pixels));
+		int i;
+		for (i = 0; i < pxCount; i++)
+		{
+			const int x = i % SCREEN_SIZE, y = i / SCREEN_SIZE;
+			const bool changed = frame == 1 ? isInRect(x, y, 2, 3, 4, 3) :
+					frame == 2 && isInRect(x, y, 0, 0, 2, 2);
+			if (changed == (memcmp(&pixels[i], &background[i], sizeof(argb)) == 0))
+				bad++;
+		}
+	}
+	closeGif(info);
+	return bad;
+}
+
+int main(void)
+{
+	if (!initGifCore())
+		return 1;
+	int failures = 0;
+	int disposal;
+	for (disposal = DISPOSAL_UNSPECIFIED; disposal <= DISPOSE_PREVIOUS; disposal++)
+	{
+		const int bad = checkSequence(disposal);
+		printf("previous then disposal %d: %s", disposal, bad == 0 ? "ok\n" : "FAILED");
+		if (bad != 0)
+		{
+			printf(", %d bad pixels\n", bad);
+			failures++;
+		}
+	}
+	releaseGifCore();
+	return failures == 0 ? 0 : 1;
+}
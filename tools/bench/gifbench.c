@@ -0,0 +1,593 @@
+/**
+ * Measures rendering of GIFs from memory through the entry points of gif.h,
+ * without JVM, and prints one CSV row per file, so that numbers of two builds
+ * can be compared.
+ * Without file arguments a synthetic corpus is generated in memory from a fixed
+ * seed, the same on every run: each of canvas sizes below, progressive and
+ * interlaced, all four disposal methods, global and local palettes, opaque and
+ * transparent frames. With -w it is written to given directory instead, eg. to
+ * render the same files on a device.
+ * Each file is opened, then all of its frames are rendered given number of
+ * times, with time advanced so that every call draws a frame. Animation stops
+ * after loop count stored in file, so fewer loops may be done.
+ * Columns are times per pixel of frame rectangles processed, in nanoseconds:
+ *  - open: whole openGifMemory, metadata: its pass over records (DDGifSlurp),
+ *  - lzw: LZW decoding alone, by a separate giflib pass over image data,
+ *  - decode: decode stage of rendering, LZW decoding and, with
+ *    DECODE_TO_CANVAS, copying of decoded lines to canvas,
+ *  - dispose: disposal of previous frame,
+ *  - blit: blit stage plus decode time over lzw one, ie. copying to canvas
+ *    whether it is fused with LZW decoding or not,
+ *  - frame: whole frame rendering,
+ * followed by frames per second over all loops and peak RSS of the process so
+ * far. Corpus grows in size, to compare files given as arguments pass one per
+ * run. Stage times come from trace events, so gif.c is built with GIF_TRACE.
+ *
+ * Usage: gifbench [-l loops] [-s sampleSize] [-p policy] [-w dir] [file.gif...]
+ */
+#include "gif.h"
+
+#include <sys/resource.h>
+
+#ifndef GIF_TRACE
+#error "stage times come from trace events, build with -DGIF_TRACE"
+#endif
+
+/**
+ * Time step between rendered frames in milliseconds, longer than any frame
+ * duration (65535 centiseconds).
+ */
+#define FRAME_STEP 1000000
+
+#define MAX_STAGES 32
+#define COLOR_BITS 8
+#define FRAME_COUNT 8
+#define LZW_MAX_CODE 4096
+#define LZW_HASH_SIZE 8192
+
+static const struct
+{
+	GifWord width;
+	GifWord height;
+} corpusSizes[] = { { 64, 64 }, { 480, 320 }, { 1280, 720 } };
+
+static const char* const disposalNames[] = { "unspecified", "none",
+		"background", "previous" };
+
+typedef struct
+{
+	GifWord width;
+	GifWord height;
+	bool isInterlaced;
+	int disposal;
+	bool hasLocalPalettes;
+	bool isTransparent;
+} CorpusCase;
+
+typedef struct
+{
+	GifByteType* data;
+	size_t length;
+	size_t capacity;
+	bool failed;
+} GifWriter;
+
+typedef struct
+{
+	GifWriter* w;
+	GifByteType block[255];
+	int blockLength;
+	uint32_t bits;
+	int bitCount;
+	int codeSize;
+} CodeWriter;
+
+static uint32_t seed;
+
+static uint32_t nextRandom(void)
+{
+	seed = seed * 1103515245U + 12345U;
+	return seed >> 8;
+}
+
+static int64_t getNanoTime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long getPeakRssKb(void)
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+	return usage.ru_maxrss;
+}
+
+static GifByteType* readFile(const char* path, unsigned long* size)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+		return NULL;
+	GifByteType* data = NULL;
+	long length;
+	if (fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) > 0
+			&& fseek(file, 0, SEEK_SET) == 0)
+	{
+		data = malloc((size_t) length);
+		if (data != NULL && fread(data, 1, (size_t) length, file) != (size_t) length)
+		{
+			free(data);
+			data = NULL;
+		}
+		*size = (unsigned long) length;
+	}
+	fclose(file);
+	return data;
+}
+
+static void putByte(GifWriter* w, GifByteType b)
+{
+	if (w->length == w->capacity)
+	{
+		const size_t capacity = w->capacity > 0 ? w->capacity * 2 : 65536;
+		GifByteType* data = w->failed ? NULL : realloc(w->data, capacity);
+		if (data == NULL)
+		{
+			w->failed = true;
+			return;
+		}
+		w->data = data;
+		w->capacity = capacity;
+	}
+	w->data[w->length++] = b;
+}
+
+static void putWord(GifWriter* w, GifWord v)
+{
+	putByte(w, (GifByteType) (v & 0xFF));
+	putByte(w, (GifByteType) (v >> 8));
+}
+
+static void putPalette(GifWriter* w)
+{
+	int i;
+	for (i = 0; i < 3 << COLOR_BITS; i++)
+		putByte(w, (GifByteType) nextRandom());
+}
+
+static void flushBlock(CodeWriter* cw)
+{
+	int i;
+	if (cw->blockLength == 0)
+		return;
+	putByte(cw->w, (GifByteType) cw->blockLength);
+	for (i = 0; i < cw->blockLength; i++)
+		putByte(cw->w, cw->block[i]);
+	cw->blockLength = 0;
+}
+
+static void putCode(CodeWriter* cw, int code)
+{
+	cw->bits |= (uint32_t) code << cw->bitCount;
+	for (cw->bitCount += cw->codeSize; cw->bitCount >= 8; cw->bitCount -= 8)
+	{
+		cw->block[cw->blockLength++] = (GifByteType) (cw->bits & 0xFF);
+		cw->bits >>= 8;
+		if (cw->blockLength == sizeof(cw->block))
+			flushBlock(cw);
+	}
+}
+
+/**
+ * Writes LZW compressed image data in sub-blocks. Code size grows and table is
+ * cleared once full, in the same way giflib encoder does it.
+ */
+static void putImageData(GifWriter* w, const GifByteType* pixels, size_t count)
+{
+	//keys are prefix code and appended index plus 1, 0 marks empty slot
+	static uint32_t keys[LZW_HASH_SIZE];
+	static int codes[LZW_HASH_SIZE];
+	const int clearCode = 1 << COLOR_BITS;
+	CodeWriter cw;
+	cw.w = w;
+	cw.blockLength = 0;
+	cw.bits = 0;
+	cw.bitCount = 0;
+	cw.codeSize = COLOR_BITS + 1;
+	int nextCode = clearCode + 2;
+	memset(keys, 0, sizeof(keys));
+	putByte(w, COLOR_BITS);
+	putCode(&cw, clearCode);
+	int prefix = pixels[0];
+	size_t i;
+	for (i = 1; i < count; i++)
+	{
+		const uint32_t key = ((uint32_t) prefix << 8 | pixels[i]) + 1;
+		uint32_t slot = (key * 2654435761U) >> 19;
+		while (keys[slot] != 0 && keys[slot] != key)
+			slot = (slot + 1) & (LZW_HASH_SIZE - 1);
+		if (keys[slot] == key)
+		{
+			prefix = codes[slot];
+			continue;
+		}
+		putCode(&cw, prefix);
+		if (nextCode < LZW_MAX_CODE)
+		{
+			keys[slot] = key;
+			codes[slot] = nextCode++;
+			if (nextCode > 1 << cw.codeSize && cw.codeSize < 12)
+				cw.codeSize++;
+		}
+		else
+		{
+			putCode(&cw, clearCode);
+			memset(keys, 0, sizeof(keys));
+			cw.codeSize = COLOR_BITS + 1;
+			nextCode = clearCode + 2;
+		}
+		prefix = pixels[i];
+	}
+	putCode(&cw, prefix);
+	putCode(&cw, clearCode + 1);
+	if (cw.bitCount > 0)
+		cw.block[cw.blockLength++] = (GifByteType) cw.bits;
+	flushBlock(&cw);
+	putByte(w, 0);
+}
+
+/**
+ * Fills frame with diagonal color bands, a random index in every eighth pixel.
+ * Transparent frames have 25% of pixels transparent (index 0), in 16x16 blocks.
+ */
+static void fillFrame(GifByteType* pixels, const CorpusCase* c, int frame,
+		GifWord left, GifWord top, GifWord width, GifWord height)
+{
+	int x, y;
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++)
+		{
+			const int cx = left + x, cy = top + y;
+			GifByteType index = (GifByteType) (nextRandom() % 8 == 0 ?
+					nextRandom() : (uint32_t) (cx + cy + frame * 8) / 8);
+			if (c->isTransparent)
+				index = (cx / 16 + cy / 16 + frame) % 4 == 0 ? 0 : index | 1;
+			pixels[y * width + x] = index;
+		}
+}
+
+static void putFrame(GifWriter* w, const CorpusCase* c, int frame,
+		GifByteType* pixels)
+{
+	//first frame covers whole canvas, others are quarters moving diagonally
+	const GifWord width = frame == 0 ? c->width : c->width / 2;
+	const GifWord height = frame == 0 ? c->height : c->height / 2;
+	const GifWord left = frame == 0 ? 0 : frame * c->width / 16;
+	const GifWord top = frame == 0 ? 0 : frame * c->height / 16;
+	putByte(w, '!');
+	putByte(w, GRAPHICS_EXT_FUNC_CODE);
+	putByte(w, 4);
+	putByte(w, (GifByteType) (c->disposal << 2 | (c->isTransparent ? 1 : 0)));
+	putWord(w, 10);
+	putByte(w, 0);
+	putByte(w, 0);
+	putByte(w, ',');
+	putWord(w, left);
+	putWord(w, top);
+	putWord(w, width);
+	putWord(w, height);
+	putByte(w, (GifByteType) ((c->hasLocalPalettes ? 0x80 | (COLOR_BITS - 1) : 0)
+			| (c->isInterlaced ? 0x40 : 0)));
+	if (c->hasLocalPalettes)
+		putPalette(w);
+	fillFrame(pixels, c, frame, left, top, width, height);
+	//rows of interlaced frames are not reordered, they just show up elsewhere
+	putImageData(w, pixels, (size_t) width * height);
+}
+
+/**
+ * Generates GIF of given case, from the same seed whatever cases came before.
+ * @return false if out of memory, w->data has to be freed anyway
+ */
+static bool writeCorpusGif(GifWriter* w, const CorpusCase* c)
+{
+	static const GifByteType netscape[] = { 0x21, 0xFF, 0x0B, 'N', 'E', 'T',
+			'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00 };
+	GifByteType* pixels = malloc((size_t) c->width * c->height);
+	if (pixels == NULL)
+		return false;
+	seed = 12345;
+	size_t i;
+	int frame;
+	w->length = 0;
+	for (i = 0; i < 6; i++)
+		putByte(w, (GifByteType) "GIF89a"[i]);
+	putWord(w, c->width);
+	putWord(w, c->height);
+	putByte(w, (GifByteType) ((c->hasLocalPalettes ? 0 : 0x80) | 0x70
+			| (COLOR_BITS - 1)));
+	putByte(w, 0);
+	putByte(w, 0);
+	if (!c->hasLocalPalettes)
+		putPalette(w);
+	for (i = 0; i < sizeof(netscape); i++)
+		putByte(w, netscape[i]);
+	for (frame = 0; frame < FRAME_COUNT; frame++)
+		putFrame(w, c, frame, pixels);
+	putByte(w, ';');
+	free(pixels);
+	return !w->failed;
+}
+
+static void getCorpusName(char* name, size_t size, const CorpusCase* c)
+{
+	snprintf(name, size, "%dx%d-%s-%s-%s-%s", c->width, c->height,
+			c->isInterlaced ? "interlaced" : "progressive",
+			disposalNames[c->disposal], c->hasLocalPalettes ? "local" : "global",
+			c->isTransparent ? "transparent" : "opaque");
+}
+
+/**
+ * Decodes all images with giflib alone, each line into the same buffer.
+ * @return nanoseconds spent in DGifGetLine, -1 on error
+ */
+static int64_t timeLzw(const GifByteType* data, unsigned long size)
+{
+	int error = 0;
+	GifFileType* gif = DGifOpenMem(NULL, data, size, &error);
+	if (gif == NULL)
+		return -1;
+	GifPixelType* line = malloc(gif->SWidth > 0 ? gif->SWidth : 1);
+	GifRecordType recordType = UNDEFINED_RECORD_TYPE;
+	GifByteType* extension;
+	int extCode;
+	int64_t elapsed = 0;
+	while (line != NULL && recordType != TERMINATE_RECORD_TYPE)
+	{
+		if (DGifGetRecordType(gif, &recordType) == GIF_ERROR)
+			break;
+		if (recordType == IMAGE_DESC_RECORD_TYPE)
+		{
+			if (DGifGetImageDesc(gif, true) == GIF_ERROR
+					|| gif->Image.Width > gif->SWidth)
+				break;
+			const int64_t start = getNanoTime();
+			int y;
+			for (y = 0; y < gif->Image.Height; y++)
+				if (DGifGetLine(gif, line, gif->Image.Width) == GIF_ERROR)
+					break;
+			elapsed += getNanoTime() - start;
+			if (y < gif->Image.Height)
+				break;
+		}
+		else if (recordType == EXTENSION_RECORD_TYPE)
+		{
+			if (DGifGetExtension(gif, &extCode, &extension) == GIF_ERROR)
+				break;
+			while (extension != NULL)
+				if (DGifGetExtensionNext(gif, &extension, &extCode) == GIF_ERROR)
+					break;
+			if (extension != NULL)
+				break;
+		}
+	}
+	const bool ok = line != NULL && recordType == TERMINATE_RECORD_TYPE;
+	free(line);
+	DGifCloseFile(gif);
+	return ok ? elapsed : -1;
+}
+
+static void printFailure(const char* name, const char* error, int errorCode)
+{
+	printf("%s,,,,,,,,,,,,,,%s", name, error);
+	if (errorCode != 0)
+		printf(" %d", errorCode);
+	printf("\n");
+}
+
+static long long getStageNanos(const StageTime* stages, int stageCount,
+		const char* name)
+{
+	int i;
+	for (i = 0; i < stageCount; i++)
+		if (strcmp(stages[i].name, name) == 0)
+			return stages[i].nanos;
+	return 0;
+}
+
+/**
+ * Prints CSV row of given GIF, or row with error column only if it cannot be
+ * opened.
+ * @return false on errors
+ */
+static bool benchmarkGif(const char* name, const GifByteType* data,
+		unsigned long size, int loops, int sampleSize, int policy)
+{
+	StageTime stages[MAX_STAGES];
+	int stageCount = sumGifTrace(stages, 0, MAX_STAGES);
+	RenderMetaData meta;
+	int64_t start = getNanoTime();
+	GifInfo* info = openGifMemory(data, size, false, sampleSize, &meta);
+	const int64_t openNs = getNanoTime() - start;
+	if (info == NULL)
+	{
+		printFailure(name, "open failed", meta.errorCode);
+		return false;
+	}
+	stageCount = sumGifTrace(stages, 0, MAX_STAGES);
+	const long long metadataNs = getStageNanos(stages, stageCount, "metadata");
+
+	setGifFramePolicy(info, policy);
+	if (info->loopCount > 0 && info->loopCount < loops)
+		loops = info->loopCount;
+	const GifFileType* gif = info->gifFilePtr;
+	double loopPxCount = 0;
+	int i;
+	for (i = 0; i < gif->ImageCount; i++)
+		loopPxCount += (double) gif->SavedImages[i].ImageDesc.Width
+				* gif->SavedImages[i].ImageDesc.Height;
+	const int width = meta.width, height = meta.height;
+	const long frameCount = (long) meta.imageCount * loops;
+	argb* pixels = calloc((size_t) width * height, sizeof(argb));
+	if (pixels == NULL)
+	{
+		printFailure(name, "out of memory", 0);
+		closeGif(info);
+		return false;
+	}
+
+	__time_t rt = FRAME_STEP;
+	int errorCode = 0;
+	long f;
+	start = getNanoTime();
+	for (f = 0; f < frameCount; f++, rt += FRAME_STEP)
+	{
+		renderGifFrame(info, pixels, rt, &meta);
+		if (meta.errorCode != 0 && errorCode == 0)
+			errorCode = meta.errorCode;
+	}
+	const int64_t renderNs = getNanoTime() - start;
+	//decoding ahead by other threads is stopped once it returns
+	closeGif(info);
+	free(pixels);
+	stageCount = sumGifTrace(stages, 0, MAX_STAGES);
+
+	int64_t lzwNs = 0;
+	for (i = 0; i < loops && lzwNs >= 0; i++)
+	{
+		const int64_t elapsed = timeLzw(data, size);
+		lzwNs = elapsed < 0 ? -1 : lzwNs + elapsed;
+	}
+	const double renderPxCount = loopPxCount * loops;
+	const long long decodeNs = getStageNanos(stages, stageCount, "decode");
+	long long blitNs = getStageNanos(stages, stageCount, "blit");
+	if (lzwNs >= 0 && decodeNs > lzwNs)
+		blitNs += decodeNs - lzwNs;
+	printf("%s,%d,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%ld,", name,
+			width, height, meta.imageCount, loops,
+			openNs / loopPxCount, metadataNs / loopPxCount,
+			lzwNs < 0 ? -1 : lzwNs / renderPxCount, decodeNs / renderPxCount,
+			getStageNanos(stages, stageCount, "dispose") / renderPxCount,
+			blitNs / renderPxCount,
+			getStageNanos(stages, stageCount, "frame") / renderPxCount,
+			frameCount / (renderNs / 1e9), getPeakRssKb());
+	if (errorCode != 0)
+		printf("render error %d", errorCode);
+	else if (lzwNs < 0)
+		printf("lzw pass failed");
+	printf("\n");
+	return errorCode == 0 && lzwNs >= 0;
+}
+
+static bool benchmarkFile(const char* path, int loops, int sampleSize,
+		int policy)
+{
+	unsigned long size = 0;
+	GifByteType* data = readFile(path, &size);
+	if (data == NULL)
+	{
+		printFailure(path, "cannot be read", 0);
+		return false;
+	}
+	const bool ok = benchmarkGif(path, data, size, loops, sampleSize, policy);
+	free(data);
+	return ok;
+}
+
+/**
+ * Benchmarks every case of the corpus, or writes them to outDir if not NULL.
+ */
+static bool runCorpus(const char* outDir, int loops, int sampleSize, int policy)
+{
+	GifWriter w = { NULL, 0, 0, false };
+	bool ok = true;
+	size_t s;
+	int flags, disposal;
+	for (s = 0; s < sizeof(corpusSizes) / sizeof(corpusSizes[0]); s++)
+		for (flags = 0; flags < 8; flags++)
+			for (disposal = DISPOSAL_UNSPECIFIED; disposal <= DISPOSE_PREVIOUS; disposal++)
+			{
+				const CorpusCase c = { corpusSizes[s].width, corpusSizes[s].height,
+						(flags & 4) != 0, disposal, (flags & 2) != 0, (flags & 1) != 0 };
+				char name[96];
+				getCorpusName(name, sizeof(name), &c);
+				if (!writeCorpusGif(&w, &c))
+				{
+					fprintf(stderr, "%s: out of memory\n", name);
+					free(w.data);
+					return false;
+				}
+				if (outDir == NULL)
+				{
+					ok = benchmarkGif(name, w.data, w.length, loops, sampleSize,
+							policy) && ok;
+					continue;
+				}
+				char path[PATH_MAX];
+				snprintf(path, sizeof(path), "%s/%s.gif", outDir, name);
+				FILE* file = fopen(path, "wb");
+				if (file == NULL || fwrite(w.data, 1, w.length, file) != w.length)
+				{
+					fprintf(stderr, "%s: cannot be written\n", path);
+					ok = false;
+				}
+				if (file != NULL && fclose(file) != 0)
+					ok = false;
+			}
+	free(w.data);
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	int loops = 10;
+	int sampleSize = 1;
+	int policy = FRAME_POLICY_DELAY;
+	const char* outDir = NULL;
+	bool isUsageError = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "l:s:p:w:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'l':
+				loops = atoi(optarg);
+				break;
+			case 's':
+				sampleSize = atoi(optarg);
+				break;
+			case 'p':
+				policy = atoi(optarg);
+				break;
+			case 'w':
+				outDir = optarg;
+				break;
+			default:
+				isUsageError = true;
+				break;
+		}
+	}
+	if (isUsageError || loops < 1 || (outDir != NULL && optind < argc))
+	{
+		fprintf(stderr, "usage: %s [-l loops] [-s sampleSize] [-p policy] "
+				"[-w dir] [file.gif...]\n", argv[0]);
+		return 2;
+	}
+	if (outDir != NULL)
+		return runCorpus(outDir, loops, sampleSize, policy) ? 0 : 1;
+	if (!initGifCore())
+		return 1;
+	setGifTracing(true);
+	printf("file,width,height,frames,loops,open_ns_px,metadata_ns_px,lzw_ns_px,"
+			"decode_ns_px,dispose_ns_px,blit_ns_px,frame_ns_px,frames_per_s,"
+			"peak_rss_kb,error\n");
+	bool ok = true;
+	if (optind >= argc)
+		ok = runCorpus(NULL, loops, sampleSize, policy);
+	for (; optind < argc; optind++)
+		ok = benchmarkFile(argv[optind], loops, sampleSize, policy) && ok;
+	releaseGifCore();
+	return ok ? 0 : 1;
+}